@@ -4,11 +4,24 @@
 //custom Packet types used in this API
 #define PACKETBUF_ATTR_PACKET_TYPE_BEACON    5
 #define PACKETBUF_ATTR_PACKET_TYPE_BEACON_REQUEST    6
+#define PACKETBUF_ATTR_PACKET_TYPE_TELEMETRY    7
 
 //RAM consumption parameters
+//The timing, link and size parameters below are the defaults of struct 
+//bcp_config, which can be changed at runtime (see bcp_set_config())
+//Size of the packet queue of each traffic class
 #define MAX_PACKET_QUEUE_SIZE 	100
 #define MAX_ROUTING_TABLE_SIZE 	40
+//Number of bcp connections which can be opened at the same time. Every 
+//connection has its own packet queue and routing table memory. At most 4
+#define BCP_MAX_CONNECTIONS 1
 #define USER_PACKET_CONF_SIZE 4
+//Number of packets the sink buffers for the application. Must be a power of two
+#define BCP_SINK_RING_SIZE  16
+//Number of connections which can be sinks at the same time. Each one takes
+//the delivery ring and the analytics of a sink (struct bcp_sink_state); 0 
+//saves this memory on nodes which are never sinks
+#define BCP_MAX_SINKS       1
 
 #ifdef USER_PACKET_CONF_SIZE
   #define MAX_USER_PACKET_SIZE USER_PACKET_CONF_SIZE
@@ -24,10 +37,138 @@
 //Time
 #define DELAY_TIME	    CLOCK_SECOND * 120
 #define RETX_TIME           CLOCK_SECOND * 2
+//Time after which a frame handed to the radio without a sent callback is 
+//considered gone (transmit stall)
+#define BCP_TX_STALL_TIME   CLOCK_SECOND
+//Housekeeping events (beacons, telemetry, checkpoints...) may run this much 
+//early or late to share a wakeup with another event (see bcp_scheduler.h)
+#define BCP_EVENT_SLACK     (CLOCK_SECOND / 32)
 
 //Other
 #define LINK_LOSS_ALPHA   90  // Decay parameter. 90 = 90% weight of previous link loss Estimate
 #define LINK_LOSS_V       2   // V Value used to weight link losses in Lyapunov Calculation
 #define LINK_EST_ALPHA    9   // Decay parameter. 9 = 90% weight of previous rate Estimation
 
+//Tuning of V
+//Let every node adjust its own V from its delivery rate, retransmissions and
+//queue occupancy. V is kept in tenths and starts at LINK_LOSS_V. 0 disables it
+#define BCP_V_TUNING            1
+#define BCP_V_MIN               0
+#define BCP_V_MAX               100
+#define BCP_V_STEP              5
+//Number of acknowledged packets between two adjustments
+#define BCP_V_TUNE_PACKETS      16
+//Retransmission ratio (percent) above which the link costs weigh more
+#define BCP_V_RETX_TARGET       20
+//Queue occupancy (percent of the queue size) above which they weigh less
+#define BCP_V_QUEUE_TARGET      50
+
+//Traffic classes
+//Number of traffic classes. Every class has its own queue and backlog
+#define BCP_TRAFFIC_CLASSES 2
+//Class with the highest priority
+#define BCP_CLASS_HIGHEST   0
+//Class with the lowest priority
+#define BCP_CLASS_LOWEST    (BCP_TRAFFIC_CLASSES - 1)
+//Scheduling policies between the classes
+#define BCP_SCHED_STRICT    0   // The highest priority non-empty class is served first
+#define BCP_SCHED_WEIGHTED  1   // The class with the largest weighted backpressure is served
+#define BCP_CLASS_SCHEDULING BCP_SCHED_STRICT
+//Multiplier of the backpressure weight of each class (BCP_SCHED_WEIGHTED)
+#define BCP_CLASS_WEIGHTS   { 4, 1 }
+
+//Route stability
+//Weight of the previous estimate of a neighbor backlog, in percent. 0 uses the last advertised backlog
+#define BCP_BACKLOG_ALPHA       50
+//Weight margin a neighbor needs over the current next hop to replace it
+#define BCP_SWITCH_THRESHOLD    2
+
+//Neighbor quarantine
+//Consecutive ACK timeouts after which a neighbor is not chosen for a while
+#define BCP_QUARANTINE_FAILURES     3
+//First quarantine; it doubles on every relapse, up to BCP_QUARANTINE_MAX_SHIFT times
+#define BCP_QUARANTINE_TIME         (CLOCK_SECOND * 5)
+#define BCP_QUARANTINE_MAX_SHIFT    5
+//Quarantines after which a neighbor which never acknowledged our data is 
+//considered an asymmetric link (heard, but not hearing us)
+#define BCP_ASYMMETRIC_QUARANTINES  2
+//Beacon periods after which a neighbor which has not been heard is not chosen,
+//and is removed when the table needs room or a beacon is sent. 0 keeps them
+#define BCP_NEIGHBOR_TIMEOUT        6
+
+//Hop distance to the sinks
+//Weight penalty per hop between a neighbor and its closest sink. 0 disables it
+#define BCP_HOP_PENALTY         1
+//Largest distance advertised; farther nodes advertise an unknown distance
+#define BCP_MAX_SINK_DISTANCE   32
+
+//Payload codec
+//Send the payloads of this node as deltas against a key frame, and rebuild
+//them at the sinks (see bcp_codec.h). All the nodes must agree. 0 disables it.
+//It needs larger payloads than the default USER_PACKET_CONF_SIZE: with 4 bytes
+//a delta is smaller only when the reading repeats exactly, and every other
+//packet grows by one byte
+#define BCP_CODEC               0
+//A key frame every BCP_CODEC_KEY_INTERVAL packets
+#define BCP_CODEC_KEY_INTERVAL  8
+//Key frames kept per origin by a sink
+#define BCP_CODEC_KEYS          2
+
+//Opportunistic forwarding
+//Let the neighbors which overhear a data frame take it when they are closer to
+//the sinks than its sender. ACKs are then broadcast. 0 disables it
+#define BCP_OPPORTUNISTIC       1
+//Back-off slot of the neighbors which take a frame addressed to another one
+#define BCP_ANYCAST_SLOT        (CLOCK_SECOND / 16)
+//Number of back-off slots; the neighbors with the smallest backlogs take the first ones
+#define BCP_ANYCAST_SLOTS       8
+
+//Floating queue
+//Upper bound of the virtual backlog counted on top of the packet queue. 0 disables it
+#define MAX_VIRTUAL_QUEUE_SIZE  1000
+
+//Number of data packets accepted last which are remembered to recognize
+//retransmissions whose ACK got lost
+#define BCP_DUPLICATE_CACHE     8
+//A packet whose sequence number is this far behind the last one accepted 
+//from its origin means that the origin restarted and numbers from 0 again
+#define BCP_SEQNO_RESTART_GAP   1024
+
+//Per-hop latency
+//Number of buckets of the per-hop latency histograms. Bucket k counts the 
+//delays shorter than 2^k clock ticks; the last one counts the longer ones too
+#define BCP_LATENCY_BUCKETS     12
+//Carry the per-hop latency of every packet to the sink in its header. 0 disables it
+#define BCP_HOP_SUMMARY         1
+
+//Sink analytics (see bcp_sink_stats.h)
+//Number of origins whose deliveries are tracked by a sink
+#define BCP_SINK_MAX_ORIGINS    16
+//Time between two printouts of the sink analytics. 0 disables them
+#define BCP_SINK_DUMP_TIME      (CLOCK_SECOND * 60)
+
+//Telemetry (see bcp_telemetry.h)
+//Time between two reports of a node. 0 disables telemetry
+#define BCP_TELEMETRY_TIME          (CLOCK_SECOND * 60)
+//Number of reports a node keeps; waiting to be forwarded, or as the map of a sink
+#define BCP_TELEMETRY_MAX_REPORTS   16
+//Number of reports carried by a telemetry frame
+#define BCP_TELEMETRY_PER_FRAME     6
+
+//Warm start (see bcp_checkpoint.h)
+//Time between two checkpoints of the routing table. 0 disables checkpoints
+#define BCP_CHECKPOINT_TIME         (CLOCK_SECOND * 300)
+//Bytes of weight estimator state saved per neighbor
+#define BCP_CHECKPOINT_STATE_SIZE   8
+//Time given to the restored neighbors to confirm they are still there
+#define BCP_PROVISIONAL_TIME        (CLOCK_SECOND * 15)
+
+//Event trace (see bcp_trace.h)
+//Trace points compiled in; bit n enables the event n. 0 removes the trace
+#define BCP_TRACE_MASK          0xFFFF
+//Number of records of the trace ring. Must be a power of two
+#define BCP_TRACE_SIZE          64
+//Time between two drains of the trace ring to the serial line. 0 disables draining
+#define BCP_TRACE_DRAIN_TIME    (CLOCK_SECOND / 4)
+
 #endif
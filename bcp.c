@@ -11,11 +11,29 @@
 #include "net/netstack.h"
 #include "bcp_extend.h"
 #include "bcp_queue_allocator.h"
+#include "bcp_trace.h"
+#include "bcp_checkpoint.h"
 
 #include <stddef.h>  //For offsetof
 #include "lib/list.h"
 
-#define DEBUG 1
+//The delivery ring of a sink is a single producer / single consumer ring. On
+//hosts with atomics, the application may drain it from another thread 
+#if defined(__GNUC__) && defined(__ATOMIC_ACQUIRE)
+#define LOAD_ACQUIRE(x)         __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define LOAD_RELAXED(x)         __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define STORE_RELEASE(x, v)     __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+#else
+#define LOAD_ACQUIRE(x)         (x)
+#define LOAD_RELAXED(x)         (x)
+#define STORE_RELEASE(x, v)     ((x) = (v))
+#endif
+
+#if (BCP_SINK_RING_SIZE == 0) || (BCP_SINK_RING_SIZE & (BCP_SINK_RING_SIZE - 1))
+#error "BCP_SINK_RING_SIZE must be a power of two"
+#endif
+
+#define DEBUG 0
 #if DEBUG
 #include <stdio.h>
 #define PRINTF(...) printf(__VA_ARGS__)
@@ -24,6 +42,12 @@
 #endif
 
 
+//Trace point with the backlog and the queue length of the given class
+#define TRACE(c, event, tclass, neighbor) BCP_TRACE(event, tclass, neighbor, \
+        bcp_queue_backlog(&(c)->packet_queue[tclass]), \
+        bcp_queue_length(&(c)->packet_queue[tclass]))
+
+
 /*********************************DECLARATIONS*********************************/
 static const struct packetbuf_attrlist attributes[] = {
     BCP_ATTRIBUTES
@@ -37,9 +61,17 @@ static const struct packetbuf_attrlist attributes[] = {
  */
 struct beacon_msg {
   /**
-  * The queue length of the node. 
+  * The queue length of the node for every traffic class. 
+  */
+  uint16_t queuelog[BCP_TRAFFIC_CLASSES]; 
+  /**
+  * Non-zero if the node is a sink. 
+  */
+  uint8_t isSink;
+  /**
+  * Number of hops between the node and its closest sink. 
   */
-  uint16_t queuelog; 
+  uint8_t sink_distance;
 };
 
 /**
@@ -52,29 +84,111 @@ struct beacon_msg {
  */
 struct beacon_request_msg {
   /**
-  * The queue length of the node. 
+  * The queue length of the node for every traffic class. 
+  */
+  uint16_t queuelog[BCP_TRAFFIC_CLASSES];
+  /**
+  * Non-zero if the node is a sink. 
+  */
+  uint8_t isSink;
+  /**
+  * Number of hops between the node and its closest sink. 
   */
-  uint16_t queuelog;
+  uint8_t sink_distance;
+};
+
+/**
+ * \brief      A structure for telemetry messages.
+ *
+ *             Telemetry messages are sent without ACK to the best neighbor of 
+ *             the lowest traffic class. Only the first count reports are sent.
+ */
+struct telemetry_msg {
+  uint8_t count;
+  struct bcp_telemetry reports[BCP_TELEMETRY_PER_FRAME];
 };
 
 /**
  * \brief      A structure for acknowledgment messages.
+ *
+ *             With BCP_OPPORTUNISTIC, ACKs are broadcast so that the other 
+ *             neighbors which heard the data packet give it up.
  */
 struct ack_msg {
+  /**
+  * The origin and sequence number of the acknowledged packet. 
+  */
+  rimeaddr_t origin;
+  uint16_t seqno;
+  /**
+  * BCP_ACK_SINK if the receiver is a sink. 
+  */
+  uint8_t flags;
 };
 
+#define BCP_ACK_SINK    0x01
+
 
 
 static void send_beacon_request(void *ptr);
 static void send_beacon(void *ptr);
+static void tx_beacon_request(struct bcp_conn *c);
+static void tx_beacon(struct bcp_conn *c);
+static bool tx_telemetry(struct bcp_conn *c);
+static void tx_enter(struct bcp_conn *c, uint8_t state);
+static void tx_stalled(void *ptr);
+static void tx_late_over(void *ptr);
+static void control_left(struct bcp_conn *c);
+static void request_control(struct bcp_conn *c, uint8_t frame);
+static void data_left(struct bcp_conn *c);
+static void tx_dispatch(struct bcp_conn *c);
+static void tx_ack(struct bcp_conn *c);
+#if BCP_OPPORTUNISTIC
+static void ack_left(struct bcp_conn *c);
+#endif
 static bool isBeacon();
 static void prepare_packetbuf();
 static bool isBeaconRequest();
+static bool isTelemetry();
+static void send_telemetry(void *ptr);
+static void recv_telemetry(struct bcp_conn *c);
 static bool isBroadcast(rimeaddr_t * addr);
 static void send_packet(void *ptr);
-struct bcp_queue_item* push_packet_to_queue(struct bcp_conn *c);
-static void send_ack(struct bcp_conn *bc, const rimeaddr_t *to);
+struct bcp_queue_item* push_packet_to_queue(struct bcp_conn *c, uint8_t tclass);
+static void get_backlogs(struct bcp_conn *c, uint16_t *queuelog);
+static uint8_t get_sink_distance(struct bcp_conn *c);
+static void update_neighbor(struct bcp_conn *c, const rimeaddr_t *from,
+                            const struct bcp_packet_header *hdr);
+static bool sink_deliver(struct bcp_conn *c, struct bcp_queue_item *pk, bool queued);
+static void sink_notify(struct bcp_conn *c, bool wasEmpty);
+static bool sink_ring_empty(struct bcp_conn *c);
+static void send_ack(struct bcp_conn *bc, const rimeaddr_t *to,
+                     const struct bcp_packet_header *hdr);
+static void ack_received(struct bcp_conn *c, const rimeaddr_t *from,
+                         const struct ack_msg *m);
+static void accept_data(struct bcp_conn *bc, const rimeaddr_t *from,
+                        struct bcp_queue_item *dm);
+static bool isAck();
+#if BCP_OPPORTUNISTIC
+static void anycast_overheard(struct bcp_conn *c, const rimeaddr_t *from);
+static void anycast_take(void *ptr);
+#endif
 static void retransmit_callback(void *ptr);
+static void ack_timeout(void *ptr);
+static void save_checkpoint(void *ptr);
+static void confirm_neighbors(void *ptr);
+static void update_queue_peak(struct bcp_conn *c, uint8_t tclass);
+static bool is_duplicate(struct bcp_conn *c, const struct bcp_packet_header *hdr);
+static void record_stage(struct bcp_conn *c, uint8_t stage, clock_time_t t);
+static void add_stage_delay(struct bcp_queue_item *i, uint8_t stage, clock_time_t t);
+static void measure_wait(struct bcp_conn *c, struct bcp_queue_item *i);
+#if BCP_CODEC
+static struct bcp_queue_item *key_frame_first(struct bcp_queue_item *i);
+#endif
+static void sink_dump(void *ptr);
+static void remember_packet(struct bcp_conn *c, const struct bcp_packet_header *hdr);
+static void packet_completed(struct bcp_conn *c, struct bcp_queue_item *i,
+                             uint8_t outcome);
 
 
 /*********************************CALLBACKS************************************/
@@ -88,9 +202,7 @@ static void retransmit_callback(void *ptr);
  */
 static void recv_from_unicast(struct unicast_conn *c, const rimeaddr_t *from)
 {
-    struct bcp_queue_item *i;
     struct ack_msg m;
-    struct routingtable_item * ri;
 
     PRINTF("DEBUG: Receiving an ACK via the unicast channel\n");
     
@@ -100,12 +212,38 @@ static void recv_from_unicast(struct unicast_conn *c, const rimeaddr_t *from)
     //Copy the header
     memcpy(&m, packetbuf_dataptr(), sizeof(struct ack_msg));
     
+    ack_received(bcp_conn, from, &m);
+}
+
+/**
+ * \breif Handles an ACK sent to this node
+ * \param bcp_conn the bcp connection
+ * \param from the neighbor which acknowledged the packet
+ * \param m the ACK
+ */
+static void ack_received(struct bcp_conn *bcp_conn, const rimeaddr_t *from,
+                         const struct ack_msg *m)
+{
+    struct bcp_queue_item *i;
+    struct routingtable_item * ri;
+    
     //Remove the packet from the packet queue
-    i = bcp_queue_top(&bcp_conn->packet_queue);
+    i = bcp_conn->tx_item;
+    
+    //Late ACKs of packets which are already gone are ignored
+    if(i != NULL && (i->hdr.seqno != m->seqno 
+            || !rimeaddr_cmp(&i->hdr.origin, &m->origin))){
+        PRINTF("DEBUG: ACK of another packet than the current one\n");
+        return;
+    }
     
     if(i != NULL) {
+        uint16_t attempts = bcp_conn->tx_attempts;
       
         PRINTF("DEBUG: ACK received removing the current active packet from the queue\n");
+        bcp_conn->stats.acks_received++;
+        record_stage(bcp_conn, BCP_STAGE_ACK, clock_time() - bcp_conn->ack_wait_start);
+        TRACE(bcp_conn, BCP_TRACE_ACK_RECEIVED, i->hdr.tclass, from);
         // Reset BCP connection for next packet to send
         bcp_conn->tx_attempts = 0;
         
@@ -118,29 +256,126 @@ static void recv_from_unicast(struct unicast_conn *c, const rimeaddr_t *from)
         }
         
         //Stop retransmission timer
-        ctimer_stop(&bcp_conn->retransmission_timer);
-        //Remove the packet from the queue
-        bcp_queue_remove(&bcp_conn->packet_queue, i);
+        scheduler_stop(&bcp_conn->events, BCP_EVENT_ACK_TIMEOUT);
+        
+        packet_completed(bcp_conn, i, (m->flags & BCP_ACK_SINK) ? 
+                BCP_OUTCOME_SINK_ACKED : BCP_OUTCOME_FORWARDED);
+        
+        routingtable_link_succeeded(&bcp_conn->routing_table, from);
         
         //Notify the weight estimator
         ri = routing_table_find(&bcp_conn->routing_table, from);
+        if(ri != NULL)
+            weight_estimator_sent(bcp_conn, ri, i, attempts);
         
-        uint32_t link_estimate_time = DELAY_TIME 
-                - timer_remaining(&bcp_conn->delay_timer);
+        //Remove the packet from the queue
+        bcp_queue_remove(&bcp_conn->packet_queue[i->hdr.tclass], i);
+        bcp_conn->tx_item = NULL;
         
-        weight_estimator_sent(ri, i, bcp_conn->tx_attempts);
+        //An ACK may overtake the sent callback of its data frame
+        tx_enter(bcp_conn, BCP_TX_IDLE);
 
-        bcp_conn->busy = false;
-        
         // Reset the send data timer in case their are other packets in the queue
-        clock_time_t time = SEND_TIME_DELAY;
-        ctimer_set(&bcp_conn->send_timer, time, send_packet, bcp_conn);
+        clock_time_t time = bcp_conn->config.send_delay;
+        scheduler_set(&bcp_conn->events, BCP_EVENT_SEND, time, send_packet);
         
     }else{
         PRINTF("ERROR: Cannot find the current active packet. ACK cannot be sent\n");
     }
 }
 
+/**
+ * \breif Takes a data packet which was sent to this node, or which this node
+ *        took for its addressed neighbor (see BCP_OPPORTUNISTIC)
+ * \param bc the bcp connection
+ * \param from the neighbor which sent the packet
+ * \param dm the received packet
+ */
+static void accept_data(struct bcp_conn *bc, const rimeaddr_t *from,
+                        struct bcp_queue_item *dm)
+{
+    //Packets of an unknown class are served with the lowest priority
+    uint8_t tclass = dm->hdr.tclass;
+    if(tclass >= BCP_TRAFFIC_CLASSES)
+        tclass = BCP_CLASS_LOWEST;
+    PRINTF("DEBUG: Received a forwarded data packet sent to node[%d].[%d] (Origin: [%d][%d]), class=%d, BCP=%d, delay=%x \n",
+          rimeaddr_node_addr.u8[0], 
+          rimeaddr_node_addr.u8[1], 
+          dm->hdr.origin.u8[0],
+          dm->hdr.origin.u8[1],
+          tclass,
+          dm->hdr.bcp_backpressure[tclass],
+          dm->hdr.delay);
+    
+    //We already have this packet; only our ACK has been lost
+    if(is_duplicate(bc, &dm->hdr)){
+        PRINTF("DEBUG: Duplicate data packet, sending the ACK again\n");
+        bc->stats.duplicates++;
+        TRACE(bc, BCP_TRACE_DUPLICATE, tclass, from);
+        update_neighbor(bc, from, &dm->hdr);
+        send_ack(bc, from, &dm->hdr);
+        return;
+    }
+    
+    if(!bc->isSink){
+        //Add this packet to the queue so that we can forward it in the near future
+        struct bcp_queue_item* itm;
+        itm = bcp_queue_push(&bc->packet_queue[tclass], dm);
+         //Notify the extender
+        if(bc->ce != NULL && bc->ce->onReceivingData != NULL)
+                bc->ce->onReceivingData(bc, itm);
+        if(itm != NULL){
+             itm->hdr.lastProcessTime = clock_time();
+             itm->hdr.hops++;
+             itm->hdr.attempts = 0;
+             update_queue_peak(bc, tclass);
+            
+             // Reset the send data timer
+            if(scheduler_expired(&bc->events, BCP_EVENT_SEND)) {
+              clock_time_t time = bc->config.send_delay;
+              scheduler_set(&bc->events, BCP_EVENT_SEND, time, send_packet);
+            }
+        }
+        
+        //Update the routing table
+       update_neighbor(bc, from, &dm->hdr);
+       
+       //The packet is ours now; acknowledge it so that the sender 
+       //removes it from its queue. Without room the sender retries.
+       if(itm != NULL){
+           TRACE(bc, BCP_TRACE_DATA_RECEIVED, tclass, from);
+           remember_packet(bc, &itm->hdr);
+           send_ack(bc, from, &itm->hdr);
+       }else{
+           bc->stats.queue_drops++;
+           TRACE(bc, BCP_TRACE_QUEUE_DROP, tclass, from);
+       }
+        
+     }else{
+       //If it is Sink
+       PRINTF("DEBUG: Sink Received a new data packet, user will be notified, total delay(ms)=%x\n", dm->hdr.delay);
+       
+       //Update the routing table
+       update_neighbor(bc, from, &dm->hdr);
+       
+       //Save the message in the delivery ring
+       bool wasEmpty = sink_ring_empty(bc);
+       if(!sink_deliver(bc, dm, false)){
+           //No ACK; the sender keeps the packet and retries
+           TRACE(bc, BCP_TRACE_QUEUE_DROP, tclass, from);
+           return;
+       }
+       TRACE(bc, BCP_TRACE_SINK_DELIVERED, tclass, from);
+       remember_packet(bc, &dm->hdr);
+       
+       //Send ACK
+       send_ack(bc, from, &dm->hdr);
+
+       //Notify end user callbacks
+       sink_notify(bc, wasEmpty);
+    }
+}
+
 /**
  * \breif Called whenever a new packet has been received by the broadcast channel
  * \param c Broadcast channel
@@ -161,12 +396,52 @@ static void recv_from_broadcast(struct broadcast_conn *c,
     rimeaddr_t destinationAddress;
     rimeaddr_copy(&destinationAddress, packetbuf_addr(PACKETBUF_ADDR_ERECEIVER));
    
+    //Telemetry frames have no bcp header
+    if(isTelemetry()){
+        if(rimeaddr_cmp(&destinationAddress, &rimeaddr_node_addr))
+            recv_telemetry(bc);
+        return;
+    }
+    
+    //Broadcast ACKs (see BCP_OPPORTUNISTIC)
+    if(isAck()){
+        struct ack_msg m;
+        memcpy(&m, packetbuf_dataptr(), sizeof(struct ack_msg));
+        if(rimeaddr_cmp(&destinationAddress, &rimeaddr_node_addr)){
+            ack_received(bc, from, &m);
+#if BCP_OPPORTUNISTIC
+        }else if(bc->anycast_pending && bc->anycast_item.hdr.seqno == m.seqno
+                && rimeaddr_cmp(&bc->anycast_item.hdr.origin, &m.origin)){
+            //Another neighbor took the packet
+            PRINTF("DEBUG: Overheard data packet taken by another neighbor\n");
+            bc->anycast_pending = false;
+            scheduler_stop(&bc->events, BCP_EVENT_ANYCAST);
+            bc->stats.anycast_suppressed++;
+#endif
+        }
+        return;
+    }
+    
+    //Data frames end with the data; the rest of the buffer is stale
+    if(!isBroadcast(&destinationAddress)){
+        struct bcp_queue_item *dm = packetbuf_dataptr();
+        if(packetbuf_datalen() < offsetof(struct bcp_queue_item, data)){
+            PRINTF("ERROR: Truncated data frame\n");
+            return;
+        }
+        if(dm->data_length > packetbuf_datalen() - offsetof(struct bcp_queue_item, data))
+            dm->data_length = packetbuf_datalen() - offsetof(struct bcp_queue_item, data);
+        //The frame is copied into queue items, which cannot hold more
+        if(dm->data_length > MAX_USER_PACKET_SIZE)
+            dm->data_length = MAX_USER_PACKET_SIZE;
+    }
     
     //If it is a broadcast
     if(isBroadcast(&destinationAddress)){
         //It is either beacon or beacon request. 
         if(isBeacon()){
             PRINTF("DEBUG: Receiving a beacon from the broadcast channel\n");
+            TRACE(bc, BCP_TRACE_BEACON_RECEIVED, BCP_CLASS_HIGHEST, from);
     
             //Construct the beacon message
             struct beacon_msg beacon;
@@ -174,95 +449,46 @@ static void recv_from_broadcast(struct broadcast_conn *c,
             
             //Update the queue for that neighbor
             routing_table_update_queuelog(&bc->routing_table, from, beacon.queuelog);
-        }else{
+            routing_table_update_sink(&bc->routing_table, from, beacon.isSink);
+            routing_table_update_distance(&bc->routing_table, from, beacon.sink_distance);
+        }else if(isBeaconRequest()){
             PRINTF("DEBUG: Receiving a beacon request from the broadcast channel\n");
+            TRACE(bc, BCP_TRACE_BEACON_REQUEST_RECEIVED, BCP_CLASS_HIGHEST, from);
             struct beacon_request_msg br_msg;
             memcpy(&br_msg, packetbuf_dataptr(), sizeof(struct beacon_request_msg));
             
             //Update the queue for that neighbor
             routing_table_update_queuelog(&bc->routing_table, from, br_msg.queuelog);
+            routing_table_update_sink(&bc->routing_table, from, br_msg.isSink);
+            routing_table_update_distance(&bc->routing_table, from, br_msg.sink_distance);
             
             //Schedule a new beacon for the node
             //Generate random reply time to avoid collision (50ms - 1s)
             clock_time_t time = CLOCK_SECOND * 0.50f * (1+(random_rand() % 20)) ; 
-            ctimer_set(&bc->beacon_timer, time, send_beacon, bc);
+            scheduler_set(&bc->events, BCP_EVENT_BEACON, time, send_beacon);
         }
         
     }else //If this node is the destination 
         if(rimeaddr_cmp(&destinationAddress, &rimeaddr_node_addr)){
-            
-            //Abstract the message
-            struct bcp_queue_item * dm = (struct bcp_queue_item *) packetbuf_dataptr();
-            PRINTF("DEBUG: Received a forwarded data packet sent to node[%d].[%d] (Origin: [%d][%d]), BCP=%d, delay=%x \n",
-                  destinationAddress.u8[0], 
-                  destinationAddress.u8[1], 
-                  dm->hdr.origin.u8[0],
-                  dm->hdr.origin.u8[1],
-                  dm->hdr.bcp_backpressure,
-                  dm->hdr.delay);
-            
-            if(!bc->isSink){
-                //Add this packet to the queue so that we can forward it in the near future
-                struct bcp_queue_item* itm;
-                itm = bcp_queue_push(&bc->packet_queue, dm);
-                 //Notify the extender
-                if(bc->ce != NULL && bc->ce->onReceivingData != NULL)
-                        bc->ce->onReceivingData(bc, itm);
-                if(itm != NULL){
-                     itm->hdr.lastProcessTime = clock_time();
-                    
-                     // Reset the send data timer
-                    if(ctimer_expired(&(bc->send_timer))) {
-                      clock_time_t time = SEND_TIME_DELAY;
-                      ctimer_set(&bc->send_timer, time, send_packet, bc);
-                    }
-                }
-                
-                //Update the routing table
-               routing_table_update_queuelog(&bc->routing_table, from, dm->hdr.bcp_backpressure);
-                
-             }else{
-               //If it is Sink
-               PRINTF("DEBUG: Sink Received a new data packet, user will be notified, total delay(ms)=%x\n", dm->hdr.delay);
-               
-               //Save the message
-               struct bcp_queue_item pk;
-               memcpy(&pk, dm, dm->data_length);
-               
-               //Send ACK
-               send_ack(bc, from);
-
-               //Notify end user callbacks
-               //We need to rebuild packetbuf since we called send_ack
-               prepare_packetbuf();
-               
-               memcpy(packetbuf_dataptr(), &pk.data, MAX_USER_PACKET_SIZE);
-                        
-               //Notify user callback
-               if(bc->cb->recv != NULL)
-                  bc->cb->recv(bc, &pk.hdr.origin);
-               else 
-                  PRINTF("ERROR: BCP cannot notify user as the receive callback function is not set.\n");
-               
-               //Update the routing table
-               routing_table_update_queuelog(&bc->routing_table, from, pk.hdr.bcp_backpressure);
-            }
-
-           
-            
+            accept_data(bc, from, (struct bcp_queue_item *) packetbuf_dataptr());
     }else{
         //When the node is not the destination for the data pack. Just abstract 
         //the queue log from the header of the packet
         struct bcp_packet_header header;
-        memcpy(&header, packetbuf_dataptr(), sizeof(struct bcp_packet_header));
+        memcpy(&header, &((struct bcp_queue_item *) packetbuf_dataptr())->hdr, 
+                sizeof(struct bcp_packet_header));
         
         PRINTF("DEBUG: Receiving a data packet from node[%d].[%d] sent to node[%d].[%d] via the broadcast channel\n",
                from->u8[0] ,
                from->u8[1], 
                destinationAddress.u8[0], 
                destinationAddress.u8[1] );
+        TRACE(bc, BCP_TRACE_OVERHEARD, BCP_CLASS_HIGHEST, from);
         
-        routing_table_update_queuelog(&bc->routing_table, from, header.bcp_backpressure);
+        update_neighbor(bc, from, &header);
+#if BCP_OPPORTUNISTIC
+        anycast_overheard(bc, from);
+#endif
     }
     
 }
@@ -286,25 +512,61 @@ static void sent_from_broadcast(struct broadcast_conn *c, int status,
     struct bcp_conn *bcp_conn = (struct bcp_conn *)((char *)c
       - offsetof(struct bcp_conn, broadcast_conn));
 
-    // If it is a beacon
-    if(isBeacon()) {
-      bcp_conn->busy = false;
+    //The frame which stalled left at last; it has been handled already
+    if(bcp_conn->tx_late) {
+      PRINTF("DEBUG: Late sent callback of a stalled frame\n");
+      bcp_conn->tx_late = false;
+      scheduler_stop(&bcp_conn->events, BCP_EVENT_TX_STALL);
+      tx_dispatch(bcp_conn);
+      return;
+    }
+
+    //The state tells which frame left; the packetbuf may hold another one.
+    //A broadcast ACK is never in flight with another frame
+#if BCP_OPPORTUNISTIC
+    if(bcp_conn->ack_in_flight) {
+      ack_left(bcp_conn);
+    }else
+#endif
+    if(bcp_conn->tx_state == BCP_TX_CONTROL) {
+      control_left(bcp_conn);
+    }else if(bcp_conn->tx_state == BCP_TX_DATA){
+      data_left(bcp_conn);
+    }
+}
 
-      // Reset the beacon timer
-      if(ctimer_expired(&bcp_conn->beacon_timer)) {
-        clock_time_t time = BEACON_TIME;
-        ctimer_set(&bcp_conn->beacon_timer, time, send_beacon, bcp_conn);
+/**
+ * \breif Frees the transmitter after the control frame in flight left the radio.
+ * \param c the bcp connection
+ */
+static void control_left(struct bcp_conn *c){
+      // If it is a beacon, reset the beacon timer
+      if(c->tx_control == BCP_PENDING_BEACON
+              && scheduler_expired(&c->events, BCP_EVENT_BEACON)) {
+        clock_time_t time = c->config.beacon_time;
+        scheduler_set(&c->events, BCP_EVENT_BEACON, time, send_beacon);
       }
-    }else if(isBeaconRequest()){
-         bcp_conn->busy = false;
-         
-    }else{
+      tx_enter(c, BCP_TX_IDLE);
+}
+
+/**
+ * \breif Starts the wait for the ACK of the data frame which left the radio.
+ * \param bcp_conn the bcp connection
+ */
+static void data_left(struct bcp_conn *bcp_conn){
+       //The frame left the radio; the wait for the ACK starts
+       bcp_conn->ack_wait_start = clock_time();
+       record_stage(bcp_conn, BCP_STAGE_CHANNEL, 
+               bcp_conn->ack_wait_start - bcp_conn->tx_start);
+       if(bcp_conn->tx_item != NULL)
+           add_stage_delay(bcp_conn->tx_item, BCP_STAGE_CHANNEL,
+                   bcp_conn->ack_wait_start - bcp_conn->tx_start);
+       tx_enter(bcp_conn, BCP_TX_AWAIT_ACK);
+       
        //If it is a data packet, setup the retransmit timer in case we didn't receive ACK
-       clock_time_t time = RETX_TIME * bcp_conn->tx_attempts;
-       ctimer_stop(&bcp_conn->retransmission_timer);
-       ctimer_set(&bcp_conn->retransmission_timer, time, retransmit_callback,
-               bcp_conn); 
-    }
+       clock_time_t time = bcp_conn->config.retx_time * bcp_conn->tx_attempts;
+       scheduler_stop(&bcp_conn->events, BCP_EVENT_ACK_TIMEOUT);
+       scheduler_set(&bcp_conn->events, BCP_EVENT_ACK_TIMEOUT, time, ack_timeout); 
 }
 
 /**
@@ -345,6 +607,22 @@ static bool isBeaconRequest(){
             == PACKETBUF_ATTR_PACKET_TYPE_BEACON_REQUEST);
 }
 
+/**
+ * \return true if the current packet in packetbuf is a telemetry message(see \ref "struct telemetry_msg"). Otherwise, false.
+ */
+static bool isTelemetry(){
+    return (packetbuf_attr(PACKETBUF_ATTR_PACKET_TYPE) 
+            == PACKETBUF_ATTR_PACKET_TYPE_TELEMETRY);
+}
+
+/**
+ * \return true if the current packet in packetbuf is an ACK(see \ref "struct ack_msg"). Otherwise, false.
+ */
+static bool isAck(){
+    return (packetbuf_attr(PACKETBUF_ATTR_PACKET_TYPE) 
+            == PACKETBUF_ATTR_PACKET_TYPE_ACK);
+}
+
 /**
  * \breif Called by the retransmission timer
  * \param ptr the bcp connection
@@ -355,55 +633,105 @@ static bool isBeaconRequest(){
 static void retransmit_callback(void *ptr)
 {
     struct bcp_conn *c = ptr;
-    c->busy = false;
     PRINTF("DEBUG: Attempt to retransmit the data packet\n");
-    //Send beacon request message
-    send_beacon_request(c);
+    //Send beacon request message once the transmitter is free
+    c->tx_pending |= BCP_PENDING_BEACON_REQUEST;
+    tx_enter(c, BCP_TX_IDLE);
     
     //Reschedule the send timer.
-    if(ctimer_expired(&c->send_timer)) {
-        clock_time_t time = RETX_TIME ;
-        ctimer_set(&c->send_timer, time, send_packet, c); 
+    if(scheduler_expired(&c->events, BCP_EVENT_SEND)) {
+        clock_time_t time = c->config.retx_time;
+        scheduler_set(&c->events, BCP_EVENT_SEND, time, send_packet); 
     }
 }
 
+/**
+ * \breif Called by the retransmission timer when no ACK has been received
+ * \param ptr the bcp connection
+ */
+static void ack_timeout(void *ptr)
+{
+    struct bcp_conn *c = ptr;
+    uint8_t tclass = c->tx_item != NULL ? c->tx_item->hdr.tclass : BCP_CLASS_HIGHEST;
+    struct routingtable_item *ri;
+    
+    c->stats.ack_timeouts++;
+    TRACE(c, BCP_TRACE_ACK_TIMEOUT, tclass, NULL);
+    
+    ri = routing_table_find(&c->routing_table, &c->last_next_hop);
+    if(ri != NULL)
+        weight_estimator_failed(c, ri, c->tx_attempts);
+    
+    //Only the neighbor which did not answer is avoided
+    switch(routingtable_link_failed(&c->routing_table, &c->last_next_hop)){
+        case BCP_LINK_ASYMMETRIC:
+            c->stats.asymmetric_links++;
+            //Fall through
+        case BCP_LINK_QUARANTINED:
+            c->stats.quarantines++;
+            TRACE(c, BCP_TRACE_QUARANTINE, tclass, &c->last_next_hop);
+            break;
+    }
+    retransmit_callback(c);
+}
+
+/**
+ * \breif Called by the checkpoint timer to save the routing table.
+ */
+static void save_checkpoint(void *ptr)
+{
+    struct bcp_conn *c = ptr;
+    checkpoint_save(c);
+    scheduler_reset(&c->events, BCP_EVENT_CHECKPOINT);
+}
+
+/**
+ * \breif Called after a warm start when the restored neighbors had time to confirm.
+ */
+static void confirm_neighbors(void *ptr)
+{
+    struct bcp_conn *c = ptr;
+    routingtable_remove_provisional(&c->routing_table);
+}
+
 /**
  * \breif Broadcasts a beacon request message(see \ref "struct beacon_request_msg") to the one-hop neighbors.
  * \param ptr the bcp connection
  * 
+ *      The request waits while the transmitter is busy.
  */
 static void send_beacon_request(void * ptr){
-    struct bcp_conn *c = ptr; 
+    request_control(ptr, BCP_PENDING_BEACON_REQUEST);
+}
+
+/**
+ * \breif Hands a beacon request to the radio; the transmitter is idle.
+ */
+static void tx_beacon_request(struct bcp_conn *c){
     struct beacon_request_msg * br_msg;
     
-    if(c->busy == false)
-        c->busy = true;
-    else
-        return;
-    
-    //Delete all the records in the routing table
-    routingtable_clear(&c->routing_table);
-    
     prepare_packetbuf();
     packetbuf_set_datalen(sizeof(struct beacon_request_msg));
     
     br_msg = packetbuf_dataptr();
-    memset(br_msg, 0, sizeof(br_msg));
+    memset(br_msg, 0, sizeof(struct beacon_request_msg));
     
     // Store the local backpressure level to the backpressure field
-    br_msg->queuelog = bcp_queue_length(&c->packet_queue);
-     
-    //Update the packet buffer 
-    //TDOO: Check if this is required
-    memcpy(packetbuf_dataptr(), br_msg, sizeof(struct beacon_request_msg));
+    get_backlogs(c, br_msg->queuelog);
+    br_msg->isSink = c->isSink;
+    br_msg->sink_distance = get_sink_distance(c);
     
     // Set the packet type using packetbuf attribute
     packetbuf_set_attr(PACKETBUF_ATTR_PACKET_TYPE,
                      PACKETBUF_ATTR_PACKET_TYPE_BEACON_REQUEST);
 
-    PRINTF("DEBUG: Beacon Request sent via the broadcast channel. BCP=%d\n",  br_msg->queuelog);
+    PRINTF("DEBUG: Beacon Request sent via the broadcast channel. BCP=%d\n",  br_msg->queuelog[BCP_CLASS_HIGHEST]);
+    c->stats.beacon_requests_sent++;
+    TRACE(c, BCP_TRACE_BEACON_REQUEST_SENT, BCP_CLASS_HIGHEST, NULL);
     
     // Broadcast the beacon
+    c->tx_control = BCP_PENDING_BEACON_REQUEST;
+    tx_enter(c, BCP_TX_CONTROL);
     broadcast_send(&c->broadcast_conn);
 }
 
@@ -412,50 +740,611 @@ static void send_beacon_request(void * ptr){
  * \param ptr The opened BCP connection
  * 
  *      Sends a beacon via the opened broadcast channel. This function is usually
- *      called by the beacon_timer to send a beacon message when the broadcast 
- *      channel is free. 
+ *      called by the beacon_timer. The beacon waits while the transmitter is 
+ *      busy.
  * 
  */
 static void send_beacon(void *ptr)
 {
-  struct bcp_conn *c = ptr; 
-  struct beacon_msg *beacon;
+  struct bcp_conn *c = ptr;
+  
+  //Do not advertise a distance learnt from the neighbors which are gone
+  routingtable_age_out(&c->routing_table);
+  request_control(c, BCP_PENDING_BEACON);
+}
 
-  //Check if the channel is free 
-  if(c->busy == false)
-    c->busy = true;
-  else
-    return;
+/**
+ * \breif Hands a beacon to the radio; the transmitter is idle.
+ */
+static void tx_beacon(struct bcp_conn *c)
+{
+  struct beacon_msg *beacon;
 
   //Prepare the packet for the beacon 
   prepare_packetbuf();
   packetbuf_set_datalen(sizeof(struct beacon_msg));
   beacon = packetbuf_dataptr();
-  memset(beacon, 0, sizeof(beacon));
+  memset(beacon, 0, sizeof(struct beacon_msg));
 
   // Store the local backpressure level to the backpressure field
-  beacon->queuelog = bcp_queue_length(&c->packet_queue); 
-
-  //Update the packet buffer
-  //TDOO: Check if this is required
-  memcpy(packetbuf_dataptr(), beacon, sizeof(struct beacon_msg));
+  get_backlogs(c, beacon->queuelog);
+  beacon->isSink = c->isSink;
+  beacon->sink_distance = get_sink_distance(c);
 
   // Set the packet type using packetbuf attribute
   packetbuf_set_attr(PACKETBUF_ATTR_PACKET_TYPE,
                      PACKETBUF_ATTR_PACKET_TYPE_BEACON);
 
-  PRINTF("DEBUG: Sending a beacon via the broadcast channel. BCP=%d\n",  beacon->queuelog);
+  PRINTF("DEBUG: Sending a beacon via the broadcast channel. BCP=%d\n",  beacon->queuelog[BCP_CLASS_HIGHEST]);
+  c->stats.beacons_sent++;
+  TRACE(c, BCP_TRACE_BEACON_SENT, BCP_CLASS_HIGHEST, NULL);
     
   // Broadcast the beacon
+  c->tx_control = BCP_PENDING_BEACON;
+  tx_enter(c, BCP_TX_CONTROL);
   broadcast_send(&c->broadcast_conn);
 }
 
+/**
+ * \breif Builds the telemetry report of this node and starts a new reporting period.
+ */
+static void make_telemetry_report(struct bcp_conn *c, struct bcp_telemetry *r){
+    rimeaddr_copy(&r->node, &rimeaddr_node_addr);
+    r->queue_peak = c->telemetry_peak;
+    r->retransmissions = c->stats.retransmissions - c->telemetry_retx;
+    r->drops = c->stats.queue_drops - c->telemetry_drops;
+    r->neighbors = routingtable_length(&c->routing_table);
+    r->churn = c->stats.next_hop_changes - c->telemetry_churn;
+    
+    c->telemetry_peak = 0;
+    c->telemetry_retx = c->stats.retransmissions;
+    c->telemetry_drops = c->stats.queue_drops;
+    c->telemetry_churn = c->stats.next_hop_changes;
+}
+
+/**
+ * \breif Called by the telemetry timer to send the reports towards the sinks.
+ * \param ptr the bcp connection
+ * 
+ *      The own report of the node is sent with the reports received from 
+ *      other nodes. Telemetry has the lowest priority: it waits for the 
+ *      other control frames and for the data frame in flight.
+ */
+static void send_telemetry(void *ptr){
+    struct bcp_conn *c = ptr;
+    struct bcp_telemetry report;
+    
+    //Spread the reports of the nodes over time
+    scheduler_set(&c->events, BCP_EVENT_TELEMETRY, 
+            BCP_TELEMETRY_TIME + random_rand() % (BCP_TELEMETRY_TIME / 4 + 1),
+            send_telemetry);
+    
+    //A sink keeps its own report in its map
+    if(c->isSink){
+        make_telemetry_report(c, &report);
+        telemetry_merge(&c->telemetry, &report);
+        return;
+    }
+    
+    request_control(c, BCP_PENDING_TELEMETRY);
+}
+
+/**
+ * \breif Hands the telemetry reports to the radio; the transmitter is idle.
+ * \return false if there is no neighbor to send them to
+ */
+static bool tx_telemetry(struct bcp_conn *c){
+    struct bcp_telemetry report;
+    struct telemetry_msg *msg;
+    rimeaddr_t *next;
+    
+    next = routingtable_find_routing(&c->routing_table, BCP_CLASS_LOWEST);
+    if(next == NULL)
+        return false;
+    
+    make_telemetry_report(c, &report);
+    telemetry_merge(&c->telemetry, &report);
+    
+    prepare_packetbuf();
+    msg = packetbuf_dataptr();
+    msg->count = telemetry_take(&c->telemetry, msg->reports, BCP_TELEMETRY_PER_FRAME);
+    packetbuf_set_datalen(offsetof(struct telemetry_msg, reports) 
+            + msg->count * sizeof(struct bcp_telemetry));
+    packetbuf_set_attr(PACKETBUF_ATTR_PACKET_TYPE,
+                     PACKETBUF_ATTR_PACKET_TYPE_TELEMETRY);
+    packetbuf_set_addr(PACKETBUF_ADDR_ERECEIVER, next);
+    
+    c->tx_control = BCP_PENDING_TELEMETRY;
+    tx_enter(c, BCP_TX_CONTROL);
+    broadcast_send(&c->broadcast_conn);
+    return true;
+}
+
+/**
+ * \breif Moves the transmitter to the given state (BCP_TX_*).
+ * \param c the bcp connection
+ * \param state the new state
+ * 
+ *      The frames handed to the radio are guarded by the stall timer. When the
+ *      transmitter becomes idle, the waiting control frames are sent, then 
+ *      the queued data packets.
+ */
+static void tx_enter(struct bcp_conn *c, uint8_t state){
+    clock_time_t now = clock_time();
+    
+    if(c->tx_state != BCP_TX_IDLE && now - c->tx_state_since > c->stats.tx_longest_busy)
+        c->stats.tx_longest_busy = now - c->tx_state_since;
+    c->tx_state = state;
+    c->tx_state_since = now;
+    
+    if(state == BCP_TX_DATA || state == BCP_TX_CONTROL){
+        scheduler_set(&c->events, BCP_EVENT_TX_STALL, BCP_TX_STALL_TIME, tx_stalled);
+        return;
+    }
+    //The stall timer guards the ACK in flight, or the late sent callback of a 
+    //stalled frame; it resumes the transmitter
+    if(c->ack_in_flight || c->tx_late)
+        return;
+    scheduler_stop(&c->events, BCP_EVENT_TX_STALL);
+    tx_dispatch(c);
+}
+
+/**
+ * \breif Hands the waiting frames to the radio, which is free.
+ * \param c the bcp connection
+ * 
+ *      ACKs go first, also while this node waits for an ACK itself. The other
+ *      frames wait for the idle state: control frames, then the queued data.
+ */
+static void tx_dispatch(struct bcp_conn *c){
+    uint8_t k;
+    
+    if(c->tx_late)
+        return;
+    if(c->tx_pending & BCP_PENDING_ACK){
+        c->tx_pending &= ~BCP_PENDING_ACK;
+        tx_ack(c);
+        return;
+    }
+    if(c->tx_state != BCP_TX_IDLE)
+        return;
+    
+    //Control frames first; each of them leaves the idle state
+    while(c->tx_state == BCP_TX_IDLE && c->tx_pending != 0){
+        if(c->tx_pending & BCP_PENDING_BEACON_REQUEST){
+            c->tx_pending &= ~BCP_PENDING_BEACON_REQUEST;
+            tx_beacon_request(c);
+        }else if(c->tx_pending & BCP_PENDING_BEACON){
+            c->tx_pending &= ~BCP_PENDING_BEACON;
+            tx_beacon(c);
+        }else{
+            c->tx_pending &= ~BCP_PENDING_TELEMETRY;
+            tx_telemetry(c);
+        }
+    }
+    
+    //Data which waited for the transmitter
+    if(c->tx_state == BCP_TX_IDLE && scheduler_expired(&c->events, BCP_EVENT_SEND)){
+        for(k = 0; k < BCP_TRAFFIC_CLASSES; k++){
+            if(bcp_queue_top(&c->packet_queue[k]) != NULL){
+                scheduler_set(&c->events, BCP_EVENT_SEND, c->config.send_delay, send_packet);
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * \breif Called by the stall timer when the radio did not report a frame as sent.
+ */
+static void tx_stalled(void *ptr){
+    struct bcp_conn *c = ptr;
+    
+    PRINTF("ERROR: The radio did not report the frame as sent, state=%d\n", c->tx_state);
+    c->stats.tx_stalls++;
+    //Its sent callback may still come. The next frame waits for it, for one
+    //more stall period at most, so that it is not taken for its own
+    c->tx_late = true;
+#if BCP_OPPORTUNISTIC
+    if(c->ack_in_flight){
+        ack_left(c);
+    }else
+#endif
+    if(c->tx_state == BCP_TX_DATA){
+        //It may have left; its ACK or the retransmission timer will tell
+        data_left(c);
+    }else if(c->tx_state == BCP_TX_CONTROL){
+        //A stalled beacon arms the next one as a sent one does
+        control_left(c);
+    }else{
+        tx_enter(c, BCP_TX_IDLE);
+    }
+    scheduler_set(&c->events, BCP_EVENT_TX_STALL, BCP_TX_STALL_TIME, tx_late_over);
+}
+
+/**
+ * \breif Called by the stall timer when the sent callback of a stalled frame
+ *        did not come; the frame is considered lost and the transmitter resumes.
+ */
+static void tx_late_over(void *ptr){
+    struct bcp_conn *c = ptr;
+    
+    c->tx_late = false;
+    tx_dispatch(c);
+}
+
+/**
+ * \breif Sends the given control frame now if the transmitter is idle, 
+ *        otherwise once it becomes idle.
+ * \param c the bcp connection
+ * \param frame BCP_PENDING_*
+ */
+static void request_control(struct bcp_conn *c, uint8_t frame){
+    bool idle = c->tx_state == BCP_TX_IDLE && !c->ack_in_flight && !c->tx_late;
+    
+    if(!idle && !(c->tx_pending & frame))
+        c->stats.control_deferred++;
+    c->tx_pending |= frame;
+    if(idle)
+        tx_dispatch(c);
+}
+
+/**
+ * \breif Stores the reports of the telemetry message in packetbuf.
+ * 
+ *      Relays forward them with their next report; sinks add them to their map.
+ */
+static void recv_telemetry(struct bcp_conn *c){
+    struct telemetry_msg msg;
+    uint16_t len = packetbuf_datalen();
+    uint8_t k;
+    
+    if(len > sizeof(struct telemetry_msg))
+        len = sizeof(struct telemetry_msg);
+    memset(&msg, 0, sizeof(struct telemetry_msg));
+    memcpy(&msg, packetbuf_dataptr(), len);
+    
+    for(k = 0; k < msg.count && k < BCP_TELEMETRY_PER_FRAME; k++){
+        if(offsetof(struct telemetry_msg, reports) 
+                + (k + 1) * sizeof(struct bcp_telemetry) > len)
+            break;
+        telemetry_merge(&c->telemetry, &msg.reports[k]);
+    }
+}
+
+/**
+ * \breif Writes the backlog of every traffic class of the given bcp connection.
+ * \param c the bcp connection
+ * \param queuelog an array of BCP_TRAFFIC_CLASSES entries 
+ * 
+ *      Sinks consume every packet they receive, thus they always advertise a 
+ *      zero backlog. This makes every sink the bottom of the gradient, and a
+ *      packet is delivered to whichever sink the gradient leads to.
+ */
+static void get_backlogs(struct bcp_conn *c, uint16_t *queuelog){
+    uint8_t k;
+    for(k = 0; k < BCP_TRAFFIC_CLASSES; k++)
+        queuelog[k] = c->isSink ? 0 : bcp_queue_backlog(&c->packet_queue[k]);
+}
+
+/**
+ * \return the number of hops between this node and its closest sink. Sinks 
+ *         seed the distances with 0.
+ */
+static uint8_t get_sink_distance(struct bcp_conn *c){
+    return c->isSink ? 0 : routingtable_sink_distance(&c->routing_table);
+}
+
+/**
+ * \breif Updates the routing table with the header of a data packet sent by a neighbor.
+ */
+static void update_neighbor(struct bcp_conn *c, const rimeaddr_t *from,
+                            const struct bcp_packet_header *hdr){
+    routing_table_update_queuelog(&c->routing_table, from, hdr->bcp_backpressure);
+    routing_table_update_distance(&c->routing_table, from, hdr->sink_distance);
+}
+
+/**
+ * \breif Stores a data packet which reached this sink in the delivery ring.
+ * \param c the bcp connection of the sink
+ * \param pk the data packet; it may point into the packetbuf
+ * \param queued true if the packet comes from the queues of this node, whose
+ *        hop count already includes the hop to it
+ * \return true if the packet has been stored, false if the ring is full
+ * 
+ *      The user is not notified; call sink_notify() once the packetbuf is 
+ *      not needed anymore.
+ */
+static bool sink_deliver(struct bcp_conn *c, struct bcp_queue_item *pk, bool queued){
+    struct bcp_delivery *d;
+    struct bcp_sink_state *s = c->sink;
+    uint16_t tail = s->ring_tail;
+    
+    if((uint16_t)(tail - LOAD_ACQUIRE(s->ring_head)) >= BCP_SINK_RING_SIZE){
+        PRINTF("ERROR: Sink delivery ring is full, the packet is not accepted\n");
+        return false;
+    }
+    
+    d = &s->ring[tail & (BCP_SINK_RING_SIZE - 1)];
+#if BCP_CODEC
+    if(pk->hdr.codec){
+        int n = codec_decode(&s->codec_rx, &pk->hdr.origin, 
+                (const uint8_t *) pk->data, pk->data_length, (uint8_t *) d->data);
+        if(n < 0){
+            //Its key frame is lost; a retransmission would not help
+            PRINTF("ERROR: Packet cannot be decoded and is discarded\n");
+            c->stats.codec_undecodable++;
+            return true;
+        }
+        d->data_length = n;
+    }else
+#endif
+    {
+        d->data_length = pk->data_length;
+        if(d->data_length > MAX_USER_PACKET_SIZE)
+            d->data_length = MAX_USER_PACKET_SIZE;
+        memcpy(d->data, pk->data, d->data_length);
+    }
+    rimeaddr_copy(&d->origin, &pk->hdr.origin);
+    d->delay = pk->hdr.delay;
+    d->hops = queued ? pk->hdr.hops : pk->hdr.hops + 1;
+    d->tclass = pk->hdr.tclass;
+#if BCP_HOP_SUMMARY
+    memcpy(d->stage_delay, pk->hdr.stage_delay, sizeof(d->stage_delay));
+#endif
+    sink_stats_update(&s->stats, &pk->hdr);
+    
+    //Publish the entry to the consumer
+    STORE_RELEASE(s->ring_tail, (uint16_t)(tail + 1));
+    STORE_RELEASE(c->stats.delivered, c->stats.delivered + 1);
+    return true;
+}
+
+/**
+ * \breif Updates the high-water mark of the packet queue of the given class.
+ */
+static void update_queue_peak(struct bcp_conn *c, uint8_t tclass){
+    uint16_t len = bcp_queue_length(&c->packet_queue[tclass]);
+    if(len > c->stats.queue_peak[tclass])
+        c->stats.queue_peak[tclass] = len;
+    if(len > c->telemetry_peak)
+        c->telemetry_peak = len;
+}
+
+/**
+ * \breif Adds a delay to the latency histogram of the given stage.
+ * \param c the bcp connection
+ * \param stage the stage (BCP_STAGE_*)
+ * \param t the delay in clock ticks
+ */
+static void record_stage(struct bcp_conn *c, uint8_t stage, clock_time_t t){
+    uint8_t bucket = 0;
+    uint16_t *count;
+    
+    while(t > 0 && bucket < BCP_LATENCY_BUCKETS - 1){
+        t >>= 1;
+        bucket++;
+    }
+    count = &c->stats.hop_latency[stage][bucket];
+    if(*count < 0xFFFF)
+        (*count)++;
+}
+
+/**
+ * \breif Adds a delay to the stage summary carried in the header of a packet.
+ */
+static void add_stage_delay(struct bcp_queue_item *i, uint8_t stage, clock_time_t t){
+#if BCP_HOP_SUMMARY
+    uint32_t sum = (uint32_t) i->hdr.stage_delay[stage] + t;
+    i->hdr.stage_delay[stage] = sum > 0xFFFF ? 0xFFFF : sum;
+#endif
+}
+
+/**
+ * \breif Measures the time a packet waited before the attempt which is being sent.
+ * \param c the bcp connection
+ * \param i the packet
+ * 
+ *      A new packet waited in the packet queue. A packet sent again waited for 
+ *      the ACK of its previous attempt. The part of the wait during which no 
+ *      neighbor was routable is accounted to the neighbor stage.
+ */
+static void measure_wait(struct bcp_conn *c, struct bcp_queue_item *i){
+    clock_time_t now = clock_time();
+    bool retransmission = (c->tx_item == i);
+    clock_time_t waited = now - (retransmission ? c->ack_wait_start 
+                                                : i->hdr.lastProcessTime);
+    clock_time_t stalled = 0;
+    
+    if(c->no_route){
+        c->no_route = false;
+        record_stage(c, BCP_STAGE_NEIGHBOR, now - c->no_route_since);
+        stalled = now - c->no_route_since;
+        if(stalled > waited)
+            stalled = waited;
+        add_stage_delay(i, BCP_STAGE_NEIGHBOR, stalled);
+    }
+    
+    record_stage(c, retransmission ? BCP_STAGE_ACK : BCP_STAGE_QUEUE, waited - stalled);
+    add_stage_delay(i, retransmission ? BCP_STAGE_ACK : BCP_STAGE_QUEUE, waited - stalled);
+}
+
+#if BCP_CODEC
+/**
+ * \breif Picks the packet to send instead of the top of a queue.
+ * \param i the top of the queue
+ * \return the key frame the top packet was encoded against, if it waits 
+ *         below in the same queue. Otherwise, the top packet
+ * 
+ *      The queues are LIFO, so the deltas of a key frame are pushed on top of
+ *      it. Sent first, they could not be decoded at the sink.
+ */
+static struct bcp_queue_item *key_frame_first(struct bcp_queue_item *i){
+    struct bcp_queue_item *k;
+    
+    if(!i->hdr.codec)
+        return i;
+    for(k = list_item_next(i); k != NULL; k = list_item_next(k))
+        if(k->hdr.codec && rimeaddr_cmp(&k->hdr.origin, &i->hdr.origin)
+                && codec_key_of((const uint8_t *) k->data, k->data_length,
+                                (const uint8_t *) i->data, i->data_length))
+            return k;
+    return i;
+}
+#endif
+
+/**
+ * \breif Checks whether a received data packet is one of the last ones 
+ *        accepted, from any neighbor.
+ * \param c the bcp connection
+ * \param hdr the header of the packet
+ * \return true if the packet has already been accepted
+ * 
+ *      A packet far behind the ones remembered for its origin means that the
+ *      origin restarted (see BCP_SEQNO_RESTART_GAP). They are forgotten, so 
+ *      that the new packets of the origin are not taken for duplicates.
+ */
+static bool is_duplicate(struct bcp_conn *c, const struct bcp_packet_header *hdr){
+    struct bcp_received *r;
+    bool restarted = false;
+    uint8_t k;
+    
+    for(k = 0; k < BCP_DUPLICATE_CACHE; k++){
+        r = &c->rx_recent[k];
+        if(!r->used || !rimeaddr_cmp(&r->origin, &hdr->origin))
+            continue;
+        if(r->seqno == hdr->seqno)
+            return true;
+        if((int16_t)(r->seqno - hdr->seqno) > BCP_SEQNO_RESTART_GAP)
+            restarted = true;
+    }
+    
+    if(restarted){
+        PRINTF("DEBUG: Node[%d].[%d] restarted its sequence numbers\n",
+                hdr->origin.u8[0], hdr->origin.u8[1]);
+        for(k = 0; k < BCP_DUPLICATE_CACHE; k++)
+            if(rimeaddr_cmp(&c->rx_recent[k].origin, &hdr->origin))
+                c->rx_recent[k].used = false;
+    }
+    return false;
+}
+
+/**
+ * \breif Remembers a data packet accepted by this node (see \ref is_duplicate()).
+ *        It replaces the oldest one.
+ */
+static void remember_packet(struct bcp_conn *c, const struct bcp_packet_header *hdr){
+    struct bcp_received *r = &c->rx_recent[c->rx_recent_next];
+    
+    rimeaddr_copy(&r->origin, &hdr->origin);
+    r->seqno = hdr->seqno;
+    r->used = true;
+    c->rx_recent_next = (c->rx_recent_next + 1) % BCP_DUPLICATE_CACHE;
+}
+
+/**
+ * \breif Called by the dump timer of a sink to print its delivery statistics.
+ */
+static void sink_dump(void *ptr){
+    struct bcp_conn *c = ptr;
+    bcp_sink_stats_dump(c);
+    scheduler_reset(&c->events, BCP_EVENT_SINK_DUMP);
+}
+
+/**
+ * \return true if no delivery waits in the ring of the given sink
+ */
+static bool sink_ring_empty(struct bcp_conn *c){
+    return c->sink == NULL 
+            || LOAD_ACQUIRE(c->sink->ring_head) == c->sink->ring_tail;
+}
+
+#if BCP_MAX_SINKS
+//The sink states of the connections which have been sinks
+static struct bcp_sink_state sink_states[BCP_MAX_SINKS];
+#endif
+
+/**
+ * \breif Takes a sink state for the given connection.
+ * \return the state, or NULL if BCP_MAX_SINKS connections use one already
+ */
+static struct bcp_sink_state *sink_state_take(struct bcp_conn *c){
+#if BCP_MAX_SINKS
+    struct bcp_sink_state *s;
+    uint8_t k;
+    
+    for(k = 0; k < BCP_MAX_SINKS; k++){
+        s = &sink_states[k];
+        if(s->owner != NULL)
+            continue;
+        s->owner = c;
+        s->ring_head = s->ring_tail = 0;
+        sink_stats_init(&s->stats);
+#if BCP_CODEC
+        codec_rx_init(&s->codec_rx);
+#endif
+        return s;
+    }
+#else
+    (void) c;
+#endif
+    return NULL;
+}
+
+/**
+ * \breif Gives the sink state of the given connection back, if it has one.
+ */
+static void sink_state_release(struct bcp_conn *c){
+#if BCP_MAX_SINKS
+    uint8_t k;
+    
+    //A connection which is opened again may hold a state without knowing it
+    for(k = 0; k < BCP_MAX_SINKS; k++)
+        if(sink_states[k].owner == c)
+            sink_states[k].owner = NULL;
+#endif
+    c->sink = NULL;
+}
+
+/**
+ * \breif Notifies the end user about the packets waiting in the delivery ring.
+ * \param c the bcp connection of the sink
+ * \param wasEmpty whether the ring was empty before the new deliveries
+ * 
+ *      Without a delivered callback, the ring is drained right away and the 
+ *      payload of every packet is copied to the packetbuf before calling the 
+ *      receive callback. 
+ */
+static void sink_notify(struct bcp_conn *c, bool wasEmpty){
+    const struct bcp_delivery *d;
+    
+    if(c->cb->delivered != NULL){
+        if(wasEmpty)
+            c->cb->delivered(c);
+        return;
+    }
+    
+    while(bcp_sink_peek(c, &d) > 0){
+        prepare_packetbuf();
+        packetbuf_copyfrom(d->data, d->data_length);
+        
+        //Notify user callback
+        if(c->cb->recv != NULL){
+           c->cb->recv(c, (rimeaddr_t *) &d->origin);
+        }else{
+           PRINTF("ERROR: BCP cannot notify user as the receive callback function is not set.\n");
+        }
+        bcp_sink_release(c, 1);
+    }
+}
+
 /**
  * \breif Adds the current packetbuf to the packet queue for the given bcp connection.
  * \param c the bcp connection
+ * \param tclass the traffic class of the packet
  * \return The queue item for the packet. If the packet cannot be added to the queue, this function will return NULL.
  */
- struct bcp_queue_item* push_packet_to_queue(struct bcp_conn *c){
+ struct bcp_queue_item* push_packet_to_queue(struct bcp_conn *c, uint8_t tclass){
 
   
      struct bcp_queue_item newRow;
@@ -467,14 +1356,66 @@ static void send_beacon(void *ptr)
     }
     
     //Sets the fields of the new record
-    newRow.next = NULL;
-    newRow.hdr.bcp_backpressure = 0;
+    memset(&newRow, 0, sizeof(struct bcp_queue_item));
+    newRow.hdr.tclass = tclass;
     newRow.data_length = packetbuf_datalen();
     memcpy(newRow.data, packetbuf_dataptr(), newRow.data_length);
     
-    return bcp_queue_push(&c->packet_queue, &newRow);
+    return bcp_queue_push(&c->packet_queue[tclass], &newRow);
     
     
+}
+
+/**
+ * \breif Selects the traffic class to be served next and its best neighbor.
+ * \param c the bcp connection
+ * \param neighborAddr set to the best neighbor for the selected class, or NULL
+ *        if no neighbor is known
+ * \return the selected traffic class, or -1 if all the packet queues are empty
+ * 
+ *      With BCP_SCHED_STRICT the highest priority class having packets is 
+ *      served. With BCP_SCHED_WEIGHTED the class whose best neighbor has the 
+ *      largest backpressure weight, multiplied by the weight of the class, is 
+ *      served (multi-commodity backpressure).
+ */
+static int select_traffic_class(struct bcp_conn *c, rimeaddr_t **neighborAddr){
+    int tclass = -1;
+    uint8_t k;
+#if BCP_CLASS_SCHEDULING == BCP_SCHED_WEIGHTED
+    static const int class_weights[BCP_TRAFFIC_CLASSES] = BCP_CLASS_WEIGHTS;
+    long largestWeight = 0;
+    long w;
+    rimeaddr_t* addr;
+#endif
+    
+    *neighborAddr = NULL;
+    for(k = 0; k < BCP_TRAFFIC_CLASSES; k++){
+        if(bcp_queue_top(&c->packet_queue[k]) == NULL)
+            continue;
+#if BCP_CLASS_SCHEDULING == BCP_SCHED_WEIGHTED
+        addr = routingtable_find_routing(&c->routing_table, k);
+        if(addr == NULL){
+            //Without neighbors all the classes are blocked
+            return k;
+        }
+        w = weight_estimator_getWeight(c, 
+                routing_table_find(&c->routing_table, addr), k);
+        //Scaling a negative weight would favor the lighter classes
+        if(w < 0)
+            w = 0;
+        w *= class_weights[k];
+        if(tclass < 0 || w > largestWeight){
+            largestWeight = w;
+            tclass = k;
+            *neighborAddr = addr;
+        }
+#else
+        tclass = k;
+        *neighborAddr = routingtable_find_routing(&c->routing_table, k);
+        break;
+#endif
+    }
+    return tclass;
 }
 
  /**
@@ -490,41 +1431,67 @@ static void send_beacon(void *ptr)
 {
     struct bcp_conn *c = ptr;
     struct bcp_queue_item * i;
+    rimeaddr_t* neighborAddr;
+    int tclass;
     
-    // If it is busy, just return and wait for the second opportunity
-    if(c->busy == true)
+    // If the transmitter is busy, it calls again once it is idle
+    if(c->tx_state != BCP_TX_IDLE || c->ack_in_flight || c->tx_late)
       return;
     
-    i = bcp_queue_top(&c->packet_queue);
+    tclass = select_traffic_class(c, &neighborAddr);
     
-    if( i == NULL){
+    if( tclass < 0){
         PRINTF("DEBUG: Packet queue is empty; start beaconing \n");
         // Start beaconing
-        if(ctimer_expired(&c->beacon_timer))
-          ctimer_reset(&c->beacon_timer);
+        if(scheduler_expired(&c->events, BCP_EVENT_BEACON))
+          scheduler_reset(&c->events, BCP_EVENT_BEACON);
         return;
     }
     
     
+    i = bcp_queue_top(&c->packet_queue[tclass]);
+#if BCP_CODEC
+    if(i != NULL)
+        i = key_frame_first(i);
+#endif
+    
     //Make sure queuebuf is not null
-    if(1 != NULL) {
-        //Find the best neighbor to send
-        rimeaddr_t* neighborAddr = routingtable_find_routing(&c->routing_table);
-        
+    if(i != NULL) {
+        //The best neighbor to send has been found by select_traffic_class
         if(neighborAddr == NULL){
             PRINTF("ERROR: No neighbor has been found; sending a beacon request\n");
+            TRACE(c, BCP_TRACE_NO_NEIGHBOR, tclass, NULL);
+            if(!c->no_route){
+                c->no_route = true;
+                c->no_route_since = clock_time();
+            }
             retransmit_callback(c);
             return;
         }
         //Preparing bcp to send a new message
-        c->busy = true;
+        tx_enter(c, BCP_TX_DATA);
         
         // Stop the beaconing timer
-        ctimer_stop(&c->beacon_timer);
+        scheduler_stop(&c->events, BCP_EVENT_BEACON);
         
         
-        //Clear the header of the packet
-        prepare_packetbuf();
+        //Add backpressure meta data to the header. All these meta data can be overwritten by the extender
+        get_backlogs(c, i->hdr.bcp_backpressure);
+        i->hdr.sink_distance = get_sink_distance(c);
+#if BCP_OPPORTUNISTIC
+        i->hdr.anycast_backlog = routing_table_find(&c->routing_table, 
+                neighborAddr)->backpressure[tclass];
+#else
+        i->hdr.anycast_backlog = BCP_ANYCAST_OFF;
+#endif
+        measure_wait(c, i);
+        i->hdr.delay = i->hdr.delay + clock_time() - i->hdr.lastProcessTime;
+        i->hdr.lastProcessTime = clock_time();
+        
+        //The queue item is sent as it is; only its header has been patched
+        //above. The next pointer goes on air too, receivers ignore it.
+        //packetbuf_reference() clears the attributes, so they are set after it
+        packetbuf_reference(i, BCP_FRAME_LENGTH(i));
        
         // Set the packet type as data
         packetbuf_set_attr(PACKETBUF_ATTR_PACKET_TYPE,
@@ -532,38 +1499,40 @@ static void send_beacon(void *ptr)
         
         //Update the header
         packetbuf_set_addr(PACKETBUF_ADDR_ERECEIVER, neighborAddr); //Set the destination address
-       
-        //Add backpressure meta data to the header. All these meta data can be overwritten by the extender
-        i->hdr.bcp_backpressure = bcp_queue_length(&c->packet_queue); 
-        i->hdr.delay = i->hdr.delay + clock_time() - i->hdr.lastProcessTime;
-        i->hdr.lastProcessTime = i->hdr.lastProcessTime;
-        i->data_length = sizeof(struct bcp_queue_item);
-        
         
         //Notify the extender
         if(c->ce != NULL && c->ce->beforeSendingData != NULL)
                         c->ce->beforeSendingData(c, i);
-        
-        //Copy the data to the packetbuf
-        packetbuf_set_datalen(i->data_length);
-        memcpy(packetbuf_dataptr(),i, i->data_length);
-        
-        //Remove pointers
-        struct bcp_queue_item* pI = packetbuf_dataptr();
-        pI->next = NULL;
        
+        //tx_attempts counts the transmissions of this packet to this neighbor
+        if(i != c->tx_item || !rimeaddr_cmp(&c->last_next_hop, neighborAddr))
+            c->tx_attempts = 0;
         c->tx_attempts += 1;
+        if(i->hdr.attempts < 0xFF)
+            i->hdr.attempts++;
+        c->tx_item = i;
+        c->stats.data_sent++;
+        if(i->hdr.attempts > 1)
+            c->stats.retransmissions++;
+        routingtable_route_used(&c->routing_table, tclass, neighborAddr);
+        if(!rimeaddr_cmp(&c->last_next_hop, neighborAddr)){
+            if(!rimeaddr_cmp(&c->last_next_hop, &rimeaddr_null))
+                c->stats.next_hop_changes++;
+            rimeaddr_copy(&c->last_next_hop, neighborAddr);
+        }
          
-        PRINTF("DEBUG: Sending a data packet to node[%d].[%d] (Origin: [%d][%d]), BC=%d,len=%d, data=%s \n", 
+        PRINTF("DEBUG: Sending a data packet to node[%d].[%d] (Origin: [%d][%d]), class=%d, BC=%d,len=%d \n", 
                 neighborAddr->u8[0], 
                 neighborAddr->u8[1],
-                pI->hdr.origin.u8[0],
-                pI->hdr.origin.u8[1],
-                pI->hdr.bcp_backpressure,
-                pI->data_length,
-                pI->data);
+                i->hdr.origin.u8[0],
+                i->hdr.origin.u8[1],
+                tclass,
+                i->hdr.bcp_backpressure[tclass],
+                i->data_length);
+        TRACE(c, BCP_TRACE_DATA_SENT, tclass, neighborAddr);
         
         //Send the data packet via the broadcast channel
+        c->tx_start = clock_time();
         broadcast_send(&c->broadcast_conn);
         
         //Notify the extender
@@ -578,42 +1547,179 @@ static void send_beacon(void *ptr)
   * Sends an ACK to the given neighbor.
   * @param bc the BCP connection.
   * @param to the rime address of the neighbor
+  * @param hdr the header of the acknowledged packet
   */
- static void send_ack(struct bcp_conn *bc, const rimeaddr_t *to){
-    
+ static void send_ack(struct bcp_conn *bc, const rimeaddr_t *to,
+                      const struct bcp_packet_header *hdr){
+     //Both may point into the packetbuf, which is cleared before sending
+     rimeaddr_copy(&bc->ack_origin, &hdr->origin);
+     bc->ack_seqno = hdr->seqno;
+     rimeaddr_copy(&bc->ack_to, to);
+#if BCP_OPPORTUNISTIC
+     //Broadcast ACKs share the broadcast channel with the other frames. A 
+     //newer ACK replaces one which is still waiting
+     if(bc->ack_in_flight || bc->tx_late || bc->tx_state == BCP_TX_DATA 
+             || bc->tx_state == BCP_TX_CONTROL){
+         if(!(bc->tx_pending & BCP_PENDING_ACK))
+             bc->stats.control_deferred++;
+         bc->tx_pending |= BCP_PENDING_ACK;
+         return;
+     }
+#endif
+     tx_ack(bc);
+ }
+ 
+ /**
+  * \breif Hands the ACK stored in the connection to the radio.
+  * \param c the bcp connection
+  */
+ static void tx_ack(struct bcp_conn *c){
      struct ack_msg *ack;
-
+     
      prepare_packetbuf();
      packetbuf_set_datalen(sizeof(struct ack_msg));
      ack = packetbuf_dataptr();
-     memset(ack, 0, sizeof(struct ack_msg));
+     rimeaddr_copy(&ack->origin, &c->ack_origin);
+     ack->seqno = c->ack_seqno;
+     ack->flags = c->isSink ? BCP_ACK_SINK : 0;
      packetbuf_set_attr(PACKETBUF_ATTR_PACKET_TYPE,
                        PACKETBUF_ATTR_PACKET_TYPE_ACK);
+#if BCP_OPPORTUNISTIC
+     //The other neighbors which heard the packet have to hear the ACK as well
+     packetbuf_set_addr(PACKETBUF_ADDR_ERECEIVER, &c->ack_to);
+     c->ack_in_flight = true;
+     scheduler_set(&c->events, BCP_EVENT_TX_STALL, BCP_TX_STALL_TIME, tx_stalled);
+     broadcast_send(&c->broadcast_conn);
+#else
      //We use a unicast channel to send ACKS
-     unicast_send(&bc->unicast_conn, to);
+     unicast_send(&c->unicast_conn, &c->ack_to);
+#endif
+     c->stats.acks_sent++;
+     TRACE(c, BCP_TRACE_ACK_SENT, BCP_CLASS_HIGHEST, &c->ack_to);
+ }
+ 
+#if BCP_OPPORTUNISTIC
+ /**
+  * \breif Called when the broadcast ACK left the radio, or stalled.
+  */
+ static void ack_left(struct bcp_conn *c){
+     c->ack_in_flight = false;
+     scheduler_stop(&c->events, BCP_EVENT_TX_STALL);
+     tx_dispatch(c);
+ }
+#endif
+ 
+#if BCP_OPPORTUNISTIC
+ /**
+  * \breif Considers taking the overheard data packet in packetbuf for the 
+  *        neighbor it was sent to.
+  * \param c the bcp connection
+  * \param from the neighbor which sent the packet
+  * 
+  *      This node may take the packet when it is closer to the sinks than the
+  *      sender, and its backlog is below the sender's and not above the one of
+  *      the addressed neighbor. It waits one back-off slot per queued packet, 
+  *      so that the best placed neighbor takes it first, and gives up when it
+  *      overhears the ACK of another neighbor.
+  */
+ static void anycast_overheard(struct bcp_conn *c, const rimeaddr_t *from){
+     struct bcp_queue_item *dm = packetbuf_dataptr();
+     uint8_t tclass = dm->hdr.tclass;
+     uint16_t backlog;
+     uint8_t distance;
+     clock_time_t time;
+     
+     if(dm->hdr.anycast_backlog == BCP_ANYCAST_OFF || c->anycast_pending)
+         return;
+     if(tclass >= BCP_TRAFFIC_CLASSES)
+         tclass = BCP_CLASS_LOWEST;
+     
+     //We took this packet already, but the sender missed our ACK
+     if(is_duplicate(c, &dm->hdr)){
+         send_ack(c, from, &dm->hdr);
+         return;
+     }
+     
+     backlog = c->isSink ? 0 : bcp_queue_backlog(&c->packet_queue[tclass]);
+     distance = get_sink_distance(c);
+     if(backlog > dm->hdr.anycast_backlog 
+             || backlog >= dm->hdr.bcp_backpressure[tclass]
+             || distance >= dm->hdr.sink_distance)
+         return;
+     
+     PRINTF("DEBUG: Candidate for the packet of node[%d].[%d], backlog=%d\n",
+             from->u8[0], from->u8[1], backlog);
+     memcpy(&c->anycast_item, dm, BCP_FRAME_LENGTH(dm));
+     c->anycast_item.hdr.lastProcessTime = clock_time();
+     c->anycast_item.hdr.attempts = 0;
+     rimeaddr_copy(&c->anycast_from, from);
+     c->anycast_pending = true;
+     
+     time = BCP_ANYCAST_SLOT 
+             * (1 + (backlog < BCP_ANYCAST_SLOTS ? backlog : BCP_ANYCAST_SLOTS - 1))
+             + random_rand() % (BCP_ANYCAST_SLOT / 2 + 1);
+     scheduler_set(&c->events, BCP_EVENT_ANYCAST, time, anycast_take);
  }
  
+ /**
+  * \breif Called by the anycast timer when no other neighbor acknowledged
+  *        the overheard packet.
+  */
+ static void anycast_take(void *ptr){
+     struct bcp_conn *c = ptr;
+     
+     if(!c->anycast_pending)
+         return;
+     c->anycast_pending = false;
+     //The back-off is part of the delay of the packet
+     c->anycast_item.hdr.delay += clock_time() 
+             - c->anycast_item.hdr.lastProcessTime;
+     PRINTF("DEBUG: Taking the packet of node[%d].[%d]\n",
+             c->anycast_from.u8[0], c->anycast_from.u8[1]);
+     c->stats.anycast_taken++;
+     accept_data(c, &c->anycast_from, &c->anycast_item);
+ }
+#endif
+ 
  /**
   * \breif Stops all the timers of the given BCP connection.
   * \param c an opened BCP connection
   */
  static void stopTimers(struct bcp_conn *c){
-     ctimer_stop(&c->send_timer);
-     ctimer_stop(&c->beacon_timer);
-     ctimer_stop(&c->retransmission_timer);
+     scheduler_stop_all(&c->events);
+     c->anycast_pending = false;
      //ctimer_stop(&c->delay_timer); 
  }
  
  /**
-  * Prepares the packetbuf of the node for a new packet.
+  * Prepares the packetbuf of the node for a new packet. The old content is 
+  * not wiped; every message sets all the bytes it sends.
   */
  static void prepare_packetbuf(){
      //PRINTF("DEBUG: Prepare Packetbuf\n");
-     memset(packetbuf_dataptr(), '\0', packetbuf_datalen()+1);
      packetbuf_clear();
      
  }
  
+ /**
+  * \breif Reports the completion of a packet to the user if this node sent it.
+  * \param c the bcp connection
+  * \param i the packet
+  * \param outcome BCP_OUTCOME_*
+  */
+ static void packet_completed(struct bcp_conn *c, struct bcp_queue_item *i,
+                              uint8_t outcome){
+     struct bcp_completion e;
+     
+     if(c->cb->completed == NULL || !rimeaddr_cmp(&i->hdr.origin, &rimeaddr_node_addr))
+         return;
+     e.handle = (int) i->hdr.seqno + 1;
+     e.outcome = outcome;
+     e.attempts = i->hdr.attempts;
+     e.latency = i->hdr.delay + clock_time() - i->hdr.lastProcessTime;
+     c->cb->completed(c, &e);
+ }
+ 
  /**
   * \breif Notifies users that the current packet in packetbuf is dropped from bcp
   */
@@ -626,25 +1732,63 @@ static void send_beacon(void *ptr)
 /******************************************************************************/
 
 /*********************************BCP PUBLIC FUNCTION**************************/
-void bcp_open(struct bcp_conn *c, uint16_t channel,
-              const struct bcp_callbacks *callbacks)
+int bcp_open(struct bcp_conn *c, uint16_t channel,
+             const struct bcp_callbacks *callbacks,
+             const struct bcp_config *config)
 {
     PRINTF("DEBUG: Opening a bcp connection\n");
+    //The settings are needed by the components initialized below
+    if(config != NULL && bcp_config_check(config)){
+        memcpy(&c->config, config, sizeof(struct bcp_config));
+    }else{
+        if(config != NULL){
+            PRINTF("ERROR: Invalid bcp settings; the defaults are used\n");
+        }
+        bcp_config_default(&c->config);
+    }
     //Set the end user callback function
     c->cb = callbacks;
     //Set the default extender interface 
     c->ce = NULL;
+    c->channel = channel;
+    scheduler_init(&c->events, c);
+    c->tx_state = BCP_TX_IDLE;
+    c->tx_state_since = clock_time();
+    c->tx_pending = 0;
+    c->ack_in_flight = false;
+    c->tx_late = false;
+    c->tx_item = NULL;
+    c->isSink = false;
+    sink_state_release(c);
+#if BCP_CODEC
+    codec_tx_init(&c->codec_tx);
+#endif
+    telemetry_init(&c->telemetry);
+    c->telemetry_peak = 0;
+    c->telemetry_retx = c->telemetry_drops = c->telemetry_churn = 0;
+    rimeaddr_copy(&c->last_next_hop, &rimeaddr_null);
+    c->anycast_pending = false;
+    c->tx_seqno = 0;
+    c->no_route = false;
+    memset(c->rx_recent, 0, sizeof(c->rx_recent));
+    c->rx_recent_next = 0;
+    memset(&c->stats, 0, sizeof(struct bcp_stats));
     
     // Initialize the lists containing in the BCP object
-    LIST_STRUCT_INIT(c, packet_queue_list);
     LIST_STRUCT_INIT(c, routing_table_list);
     
     //Initialize nested components
+    bcp_trace_init();
     routing_table_init(c);
-    weight_estimator_init(c);
     bcp_queue_init(c);
-    //Ask queue allocator to allocate memeory for the queue
-    bcp_queue_allocator_init(c);
+    //Ask the weight estimator and the queue allocator to allocate memory for
+    //the routing table and the queue
+    if(!weight_estimator_init(c) || !bcp_queue_allocator_init(c)){
+        PRINTF("ERROR: No memory left for the connection; increase BCP_MAX_CONNECTIONS\n");
+        weight_estimator_close(c);
+        bcp_queue_allocator_release(c);
+        return 0;
+    }
     
     PRINTF("DEBUG: Open a broadcast connection for the data packets and beacons of the BCP\n");
     broadcast_open(&c->broadcast_conn, channel, &broadcast_callbacks);
@@ -654,66 +1798,330 @@ void bcp_open(struct bcp_conn *c, uint16_t channel,
     unicast_open(&c->unicast_conn, channel + 1, &unicast_callbacks);
     channel_set_attributes(channel + 1, attributes);
    
-    //Broadcast the first beacon
-    send_beacon(c);
+    //Warm start: restore the neighbors of the last checkpoint and ask them 
+    //to confirm. Otherwise, broadcast the first beacon
+    if(checkpoint_restore(c) > 0){
+        send_beacon_request(c);
+        scheduler_set(&c->events, BCP_EVENT_PROVISIONAL, BCP_PROVISIONAL_TIME, confirm_neighbors);
+        //No beacon is sent now, so the sent callback does not arm the next one
+        scheduler_set(&c->events, BCP_EVENT_BEACON, c->config.beacon_time, send_beacon);
+    }else{
+        send_beacon(c);
+    }
+#if BCP_CHECKPOINT_TIME
+    scheduler_set(&c->events, BCP_EVENT_CHECKPOINT, BCP_CHECKPOINT_TIME, save_checkpoint);
+#endif
+    
+#if BCP_TELEMETRY_TIME
+    scheduler_set(&c->events, BCP_EVENT_TELEMETRY, 
+            BCP_TELEMETRY_TIME + random_rand() % (BCP_TELEMETRY_TIME / 4 + 1),
+            send_telemetry);
+#endif
+    return 1;
+}
+
+void bcp_config_default(struct bcp_config *config){
+    config->beacon_time = BEACON_TIME;
+    config->send_delay = SEND_TIME_DELAY;
+    config->retx_time = RETX_TIME;
+    config->link_loss_alpha = LINK_LOSS_ALPHA;
+    config->link_loss_v = LINK_LOSS_V;
+    config->queue_size = MAX_PACKET_QUEUE_SIZE;
+    config->routing_table_size = MAX_ROUTING_TABLE_SIZE;
+}
+
+bool bcp_config_check(const struct bcp_config *config){
+    if(config->beacon_time == 0 || config->retx_time == 0){
+        PRINTF("ERROR: The beacon and retransmission times must not be zero\n");
+        return false;
+    }
+    if(config->link_loss_alpha >= 100){
+        PRINTF("ERROR: link_loss_alpha must be below 100\n");
+        return false;
+    }
+    if(config->link_loss_v * 10 < BCP_V_MIN || config->link_loss_v * 10 > BCP_V_MAX){
+        PRINTF("ERROR: link_loss_v must be within BCP_V_MIN and BCP_V_MAX\n");
+        return false;
+    }
+    if(config->queue_size == 0 || config->queue_size > MAX_PACKET_QUEUE_SIZE){
+        PRINTF("ERROR: queue_size must be within 1 and MAX_PACKET_QUEUE_SIZE\n");
+        return false;
+    }
+    if(config->routing_table_size == 0 
+            || config->routing_table_size > MAX_ROUTING_TABLE_SIZE){
+        PRINTF("ERROR: routing_table_size must be within 1 and MAX_ROUTING_TABLE_SIZE\n");
+        return false;
+    }
+    return true;
+}
+
+int bcp_set_config(struct bcp_conn *c, const struct bcp_config *config){
+    bool newV;
+    
+    if(!bcp_config_check(config))
+        return 0;
+    newV = config->link_loss_v != c->config.link_loss_v;
+    memcpy(&c->config, config, sizeof(struct bcp_config));
+    if(newV)
+        weight_estimator_config_changed(c);
+    return 1;
+}
+
+const struct bcp_config *bcp_get_config(struct bcp_conn *c){
+    return &c->config;
 }
 
 void bcp_close(struct bcp_conn *c){
+  struct bcp_queue_item *i;
+  uint8_t k;
+  
+#if BCP_CHECKPOINT_TIME
+  checkpoint_save(c);
+#endif
+  
   // Close the broadcast connection
   broadcast_close(&c->broadcast_conn);
 
   // Close the unicast connection
   unicast_close(&c->unicast_conn);
   
-  //Clear both routing table and packet queue
+  //Clear both routing table and packet queues
   routingtable_clear(&c->routing_table);
-  bcp_queue_clear(&c->packet_queue);
+  for(k = 0; k < BCP_TRAFFIC_CLASSES; k++){
+    for(i = bcp_queue_top(&c->packet_queue[k]); i != NULL; i = list_item_next(i))
+        packet_completed(c, i, BCP_OUTCOME_DROP_CLOSED);
+    bcp_queue_clear(&c->packet_queue[k]);
+  }
+  c->tx_item = NULL;
+  
+  //Give the memory pools of the connection back
+  weight_estimator_close(c);
+  bcp_queue_allocator_release(c);
+  sink_state_release(c);
+  c->isSink = false;
   
   //Stop the timers
   stopTimers(c);
  
 }
 
-int bcp_send(struct bcp_conn *c){
+int bcp_send(struct bcp_conn *c, uint8_t tclass){
     struct bcp_queue_item *qi;
-    int result = 0;
+    int result = BCP_HANDLE_NONE;
     int maxSize = MAX_USER_PACKET_SIZE;
+#if BCP_CODEC
+    uint8_t encoded[MAX_USER_PACKET_SIZE];
+    uint16_t n;
+    maxSize -= CODEC_OVERHEAD;
+#endif
     
     //Check the length of the packet
     if(packetbuf_datalen()> maxSize){
         PRINTF("ERROR: Packet cannot be sent. Data length is bigger than maximum packet size\n");
         packet_dropped(c);
-        return 0;
+        return BCP_HANDLE_NONE;
     }
     
-    qi = push_packet_to_queue(c);
-    PRINTF("DEBUG: Receiving user request to send a data packet, data=%s \n", packetbuf_dataptr() );
+    //Check the traffic class of the packet
+    if(tclass >= BCP_TRAFFIC_CLASSES){
+        PRINTF("ERROR: Packet cannot be sent. Unknown traffic class %d\n", tclass);
+        packet_dropped(c);
+        return BCP_HANDLE_NONE;
+    }
+    
+    //A sink is the destination of its own packets
+    if(c->isSink){
+        struct bcp_queue_item pk;
+        bool wasEmpty = sink_ring_empty(c);
+        memset(&pk, 0, sizeof(struct bcp_queue_item));
+        rimeaddr_copy(&pk.hdr.origin, &rimeaddr_node_addr);
+        pk.hdr.tclass = tclass;
+        pk.hdr.seqno = c->tx_seqno++;
+        pk.data_length = packetbuf_datalen();
+        memcpy(pk.data, packetbuf_dataptr(), pk.data_length);
+        pk.hdr.lastProcessTime = clock_time();
+        if(!sink_deliver(c, &pk, true)){
+            packet_dropped(c);
+            return BCP_HANDLE_NONE;
+        }
+        sink_notify(c, wasEmpty);
+        packet_completed(c, &pk, BCP_OUTCOME_SINK_ACKED);
+        return (int) pk.hdr.seqno + 1;
+    }
+    
+    qi = push_packet_to_queue(c, tclass);
+    PRINTF("DEBUG: Receiving user request to send a data packet, len=%d \n", packetbuf_datalen());
     
     if(qi != NULL){
         // Set the origin of the packet
         rimeaddr_copy(&(qi->hdr.origin), &rimeaddr_node_addr);
         qi->hdr.delay = 0;
         qi->hdr.lastProcessTime = clock_time();
+        qi->hdr.seqno = c->tx_seqno++;
+        qi->hdr.attempts = 0;
+#if BCP_CODEC
+        qi->hdr.codec = 1;
+        n = codec_encode(&c->codec_tx, (const uint8_t *) qi->data, 
+                qi->data_length, encoded);
+        if(n < qi->data_length)
+            c->stats.codec_bytes_saved += qi->data_length - n;
+        memcpy(qi->data, encoded, n);
+        qi->data_length = n;
+#endif
+        update_queue_peak(c, tclass);
         // We have data to send, stop beaconing
-        ctimer_stop(&c->beacon_timer);
-        result = 1;
+        scheduler_stop(&c->events, BCP_EVENT_BEACON);
+        result = (int) qi->hdr.seqno + 1;
     }else{
+        c->stats.queue_drops++;
+        TRACE(c, BCP_TRACE_QUEUE_DROP, tclass, NULL);
         packet_dropped(c);
     }
     
     // Reset the send data timer
-    if(ctimer_expired(&c->send_timer)) {
-      clock_time_t time = SEND_TIME_DELAY;
-      ctimer_set(&c->send_timer, time, send_packet, c);
+    if(scheduler_expired(&c->events, BCP_EVENT_SEND)) {
+      clock_time_t time = c->config.send_delay;
+      scheduler_set(&c->events, BCP_EVENT_SEND, time, send_packet);
     }
 
     return result;
 }
 
-void bcp_set_sink(struct bcp_conn *c, bool isSink){
-    if(isSink)
-        PRINTF("DEBUG: This node is set as a sink \n");
+int bcp_set_sink(struct bcp_conn *c, bool isSink){
+    struct bcp_queue_item *i;
+    uint8_t k;
+    bool wasEmpty;
+    
+    if(isSink == c->isSink)
+        return 1;
+    //The state is kept when the node stops being a sink; the user may still
+    //read the ring and the analytics
+    if(isSink && c->sink == NULL){
+        c->sink = sink_state_take(c);
+        if(c->sink == NULL){
+            PRINTF("ERROR: No sink state left; increase BCP_MAX_SINKS\n");
+            return 0;
+        }
+    }
     c->isSink = isSink;
+    
+    if(isSink){
+        PRINTF("DEBUG: This node is set as a sink \n");
+        //Packets waiting in the queues have reached their destination. Those
+        //which do not fit into the delivery ring are dropped
+        wasEmpty = sink_ring_empty(c);
+        for(k = 0; k < BCP_TRAFFIC_CLASSES; k++){
+            while((i = bcp_queue_top(&c->packet_queue[k])) != NULL){
+                if(i == c->tx_item)
+                    c->tx_item = NULL;
+                if(!sink_deliver(c, i, true)){
+                    packet_completed(c, i, BCP_OUTCOME_DROP_SINK_FULL);
+                    prepare_packetbuf();
+                    packetbuf_copyfrom(i->data, i->data_length);
+                    packet_dropped(c);
+                }else{
+                    packet_completed(c, i, BCP_OUTCOME_SINK_ACKED);
+                }
+                bcp_queue_remove(&c->packet_queue[k], i);
+            }
+            c->packet_queue[k].virtual_backlog = 0;
+        }
+        if(!sink_ring_empty(c))
+            sink_notify(c, wasEmpty);
+#if BCP_SINK_DUMP_TIME
+        scheduler_set(&c->events, BCP_EVENT_SINK_DUMP, BCP_SINK_DUMP_TIME, sink_dump);
+#endif
+    }else{
+        scheduler_stop(&c->events, BCP_EVENT_SINK_DUMP);
+    }
+    
+    //Advertise the new backlog to the neighbors
+    send_beacon(c);
+    return 1;
+}
+
+uint32_t bcp_sink_delivered(struct bcp_conn *c){
+    return LOAD_RELAXED(c->stats.delivered);
+}
+
+const struct bcp_origin_stats *bcp_sink_origin_stats(struct bcp_conn *c, 
+                                                     const rimeaddr_t *origin){
+    if(c->sink == NULL)
+        return NULL;
+    return sink_stats_find(&c->sink->stats, origin);
+}
+
+const struct bcp_origin_stats *bcp_sink_origin_at(struct bcp_conn *c, uint8_t index){
+    if(c->sink == NULL || index >= BCP_SINK_MAX_ORIGINS 
+            || !c->sink->stats.origins[index].used)
+        return NULL;
+    return &c->sink->stats.origins[index];
+}
+
+void bcp_sink_stats_dump(struct bcp_conn *c){
+    if(c->sink != NULL)
+        sink_stats_print(&c->sink->stats);
+    telemetry_print(&c->telemetry);
+}
+
+const struct bcp_telemetry *bcp_sink_telemetry_at(struct bcp_conn *c, uint8_t index,
+                                                  clock_time_t *age){
+    if(index >= BCP_TELEMETRY_MAX_REPORTS || !c->telemetry.entries[index].used)
+        return NULL;
+    if(age != NULL)
+        *age = clock_time() - c->telemetry.entries[index].time;
+    return &c->telemetry.entries[index].report;
+}
+
+void bcp_sink_stats_reset(struct bcp_conn *c){
+    if(c->sink != NULL)
+        sink_stats_init(&c->sink->stats);
+}
+
+void bcp_stats_snapshot(struct bcp_conn *c, struct bcp_stats *stats){
+    memcpy(stats, &c->stats, sizeof(struct bcp_stats));
+    stats->lyapunov_v = weight_estimator_v(c);
+    stats->wakeups = c->events.wakeups;
+}
+
+void bcp_stats_reset(struct bcp_conn *c){
+    uint8_t k;
+    memset(&c->stats, 0, sizeof(struct bcp_stats));
+    for(k = 0; k < BCP_TRAFFIC_CLASSES; k++)
+        c->stats.queue_peak[k] = bcp_queue_length(&c->packet_queue[k]);
+    //The next telemetry report counts from the reset
+    c->telemetry_retx = c->telemetry_drops = c->telemetry_churn = 0;
+    c->events.wakeups = 0;
+}
+
+uint16_t bcp_sink_peek(struct bcp_conn *c, const struct bcp_delivery **entries){
+    struct bcp_sink_state *s = c->sink;
+    uint16_t head, waiting, index;
+    
+    if(s == NULL)
+        return 0;
+    head = s->ring_head;
+    waiting = LOAD_ACQUIRE(s->ring_tail) - head;
+    index = head & (BCP_SINK_RING_SIZE - 1);
+    *entries = &s->ring[index];
+    //Only the entries up to the end of the ring are contiguous
+    if(waiting > BCP_SINK_RING_SIZE - index)
+        waiting = BCP_SINK_RING_SIZE - index;
+    return waiting;
+}
+
+void bcp_sink_release(struct bcp_conn *c, uint16_t count){
+    struct bcp_sink_state *s = c->sink;
+    uint16_t head, waiting;
+    
+    if(s == NULL)
+        return;
+    head = s->ring_head;
+    waiting = LOAD_ACQUIRE(s->ring_tail) - head;
+    if(count > waiting)
+        count = waiting;
+    //Give the entries back to the producer
+    STORE_RELEASE(s->ring_head, (uint16_t)(head + count));
 }
 
 
@@ -13,6 +13,12 @@
 #include "bcp_queue.h"
 #include "bcp_extend.h"
 #include "bcp_weight_estimator.h"
+#include "bcp_sink_stats.h"
+#include "bcp_telemetry.h"
+#include "bcp_codec.h"
+#include "bcp_scheduler.h"
+
+struct bcp_conn;
 
 
 #define BCP_ATTRIBUTES 	{ PACKETBUF_ADDR_ERECEIVER,     PACKETBUF_ADDRSIZE }, \
@@ -20,6 +26,115 @@
 						{ PACKETBUF_ATTR_PACKET_TYPE, PACKETBUF_ATTR_BIT * 3 }, \
                             BROADCAST_ATTRIBUTES
 
+//Outcomes of the packets sent with bcp_send() (see \ref "struct bcp_completion")
+//Acknowledged by the next hop, which is a relay
+#define BCP_OUTCOME_FORWARDED       0
+//Acknowledged by a sink, or delivered locally by a sink
+#define BCP_OUTCOME_SINK_ACKED      1
+//Dropped because the delivery ring of this sink was full
+#define BCP_OUTCOME_DROP_SINK_FULL  2
+//Discarded from the queue when the connection was closed
+#define BCP_OUTCOME_DROP_CLOSED     3
+
+//Returned by bcp_send() when the packet is not accepted
+#define BCP_HANDLE_NONE             0
+
+/**
+ * \brief      A structure for the completion of a packet sent by this node.
+ */
+struct bcp_completion {
+  //The handle returned by bcp_send()
+  int handle;
+  //BCP_OUTCOME_*
+  uint8_t outcome;
+  //Transmissions of the packet by this node
+  uint16_t attempts;
+  //Time between bcp_send() and the completion
+  clock_time_t latency;
+};
+
+/**
+ * \brief      A structure for the packets delivered at a sink.
+ *
+ *             Sinks store the received packets in a ring of deliveries which 
+ *             the application reads in place and in batches (see 
+ *             \ref bcp_sink_peek()).
+ */
+struct bcp_delivery {
+  //The node which generated the packet
+  rimeaddr_t origin;
+  //End-to-end delay of the packet
+  clock_time_t delay;
+  //Number of hops the packet travelled (0 for packets generated by the sink)
+  uint8_t hops;
+  //Traffic class of the packet
+  uint8_t tclass;
+#if BCP_HOP_SUMMARY
+  //Time the packet spent in every stage along its path (see \ref "struct bcp_packet_header")
+  uint16_t stage_delay[BCP_HOP_STAGES];
+#endif
+  //The length of the data section
+  uint16_t data_length;
+  //The data section
+  char data[MAX_USER_PACKET_SIZE];
+};
+
+/**
+ * \brief      Counters of a bcp connection.
+ *
+ *             The counters are updated on the hot paths with single increments;
+ *             read them with bcp_stats_snapshot().
+ */
+struct bcp_stats {
+  //Data frames sent, including retransmissions
+  uint32_t data_sent;
+  //Data frames sent again because the previous attempt was not acknowledged
+  uint32_t retransmissions;
+  //ACKs sent and received
+  uint32_t acks_sent;
+  uint32_t acks_received;
+  //Beacons and beacon requests sent
+  uint32_t beacons_sent;
+  uint32_t beacon_requests_sent;
+  //Retransmission timers which expired before an ACK was received
+  uint32_t ack_timeouts;
+  //Packets refused because their packet queue was full
+  uint32_t queue_drops;
+  //Data packets received again after our ACK got lost
+  uint32_t duplicates;
+  //Times the data frames were sent to another neighbor than the previous one
+  uint32_t next_hop_changes;
+  //Neighbors quarantined after repeated ACK timeouts, and the quarantines of
+  //neighbors found to be asymmetric links
+  uint32_t quarantines;
+  uint32_t asymmetric_links;
+  //Overheard data packets taken for the addressed neighbor, and given up 
+  //because another neighbor acknowledged them first
+  uint32_t anycast_taken;
+  uint32_t anycast_suppressed;
+  //Frames whose sent callback never came (see BCP_TX_STALL_TIME), control 
+  //frames which waited for the transmitter, and the longest time the 
+  //transmitter stayed in one busy state, in clock ticks
+  uint32_t tx_stalls;
+  uint32_t control_deferred;
+  clock_time_t tx_longest_busy;
+  //Data packets delivered to the user while this node is a sink
+  uint32_t delivered;
+  //Payload bytes saved by the codec on the packets of this node, and 
+  //packets which this sink could not decode (see BCP_CODEC)
+  uint32_t codec_bytes_saved;
+  uint32_t codec_undecodable;
+  //Largest length reached by the packet queue of every traffic class
+  uint16_t queue_peak[BCP_TRAFFIC_CLASSES];
+  //Histograms of the time spent by the packets in every stage (BCP_STAGE_*)
+  //of this hop; see BCP_LATENCY_BUCKETS
+  uint16_t hop_latency[BCP_HOP_STAGES][BCP_LATENCY_BUCKETS];
+  //Current V of the weight estimator, in tenths (see BCP_V_TUNING)
+  uint16_t lyapunov_v;
+  //Number of times the event timer of the connection fired
+  uint32_t wakeups;
+};
+
 /**
  * \brief      A structure with callback functions for a bcp connection.
  *
@@ -36,7 +151,7 @@ struct bcp_callbacks {
   
   /**
    * Called when a packet is sent on the bcp connection. Use packetbuf library to 
-   * check packet details
+   * check packet details. With BCP_CODEC, packetbuf holds the encoded payload
    */
   void (* sent)(struct bcp_conn *c);
   
@@ -45,8 +160,92 @@ struct bcp_callbacks {
    * details.
    */
   void (* dropped)(struct bcp_conn *c);
+  
+  /**
+   * Called on a sink when its delivery ring stops being empty. The 
+   * application drains the ring with bcp_sink_peek() and bcp_sink_release()
+   * and is called again once the ring has been emptied and refilled. When 
+   * this callback is not set, recv is called once per delivered packet.
+   */
+  void (* delivered)(struct bcp_conn *c);
+  
+  /**
+   * Called once for every packet accepted by bcp_send(), when it leaves this
+   * node or is dropped. Packets which a sink sends to itself complete before
+   * bcp_send() returns. Unlike sent and dropped, packetbuf is not set.
+   */
+  void (* completed)(struct bcp_conn *c, const struct bcp_completion *e);
+};
+
+/**
+ * \brief      The runtime settings of a bcp connection.
+ *
+ *             The defaults are the macros of bcp-config.h. The memory of the
+ *             queues and of the routing table is reserved at compile time, so
+ *             their sizes can only be lowered.
+ */
+struct bcp_config {
+  //Time between beacons (BEACON_TIME)
+  clock_time_t beacon_time;
+  //Delay before sending a packet (SEND_TIME_DELAY)
+  clock_time_t send_delay;
+  //Time waited for an ACK, multiplied by the attempts (RETX_TIME)
+  clock_time_t retx_time;
+  //Weight of the previous ETX estimate in percent, below 100 (LINK_LOSS_ALPHA)
+  uint8_t link_loss_alpha;
+  //V of the weight estimator; the tuning starts from it (LINK_LOSS_V)
+  uint8_t link_loss_v;
+  //Packets per traffic class queue, 1 .. MAX_PACKET_QUEUE_SIZE
+  uint16_t queue_size;
+  //Neighbors in the routing table, 1 .. MAX_ROUTING_TABLE_SIZE
+  uint8_t routing_table_size;
+};
+
+/**
+ * \brief      A data packet accepted by a node (see BCP_DUPLICATE_CACHE)
+ */
+struct bcp_received {
+  rimeaddr_t origin;
+  uint16_t seqno;
+  bool used;
+};
+
+/**
+ * \brief      The state of a bcp connection which only sinks use. It is taken
+ *             from a pool of BCP_MAX_SINKS when the connection first becomes
+ *             a sink, and kept until it is closed.
+ */
+struct bcp_sink_state {
+  //The connection using this state, NULL if the state is free
+  struct bcp_conn *owner;
+  
+  //Ring of the packets delivered at the sink and not yet released by the user
+  struct bcp_delivery ring[BCP_SINK_RING_SIZE];
+  //Free running read and write indexes of the ring
+  uint16_t ring_head;
+  uint16_t ring_tail;
+  
+  //Per-origin delivery statistics of the sink
+  struct bcp_sink_stats stats;
+  
+#if BCP_CODEC
+  //Payload codec state of the origins whose packets this sink receives
+  struct codec_rx codec_rx;
+#endif
 };
 
+//States of the transmitter of a bcp connection
+#define BCP_TX_IDLE         0   // Nothing in flight
+#define BCP_TX_DATA         1   // A data frame has been handed to the radio
+#define BCP_TX_AWAIT_ACK    2   // The data frame left; waiting for its ACK
+#define BCP_TX_CONTROL      3   // A beacon, beacon request or telemetry frame has been handed to the radio
+
+//Control frames waiting for the transmitter (see tx_pending)
+#define BCP_PENDING_BEACON_REQUEST  0x01
+#define BCP_PENDING_BEACON          0x02
+#define BCP_PENDING_TELEMETRY       0x04
+#define BCP_PENDING_ACK             0x08
+
 struct bcp_conn {
   //Used to broadcast user data packets and beacons
   struct broadcast_conn broadcast_conn;
@@ -57,38 +256,102 @@ struct bcp_conn {
   // End user Callbacks
   const struct bcp_callbacks *cb;
   
+  //Runtime settings (see bcp_set_config())
+  struct bcp_config config;
+  
   //Component Extender - SPI
   const struct bcp_extender * ce;
 
-  //Flag to indicate whether the bcp channel is busy or not
-  bool busy;
+  //State of the transmitter (BCP_TX_*) and when it was entered
+  uint8_t tx_state;
+  clock_time_t tx_state_since;
+  //The control frame in flight, and the ones waiting for the transmitter 
+  //(BCP_PENDING_*)
+  uint8_t tx_control;
+  uint8_t tx_pending;
+  //A broadcast ACK is in flight (see BCP_OPPORTUNISTIC); no other frame is 
+  //handed to the radio meanwhile
+  bool ack_in_flight;
+  //A frame stalled and its sent callback may still come; no other frame is
+  //handed to the radio meanwhile, so the callback cannot be taken for its own
+  bool tx_late;
+  //The ACK to send: the neighbor, and the packet it acknowledges
+  rimeaddr_t ack_to;
+  rimeaddr_t ack_origin;
+  uint16_t ack_seqno;
   
   //Flag to indicate whether the node is sink or not
   bool isSink;
   
-  // Timer for triggering a send data packet task
-  struct ctimer send_timer;
-
-  // Timer for triggering a send beacon packet task
-  struct ctimer beacon_timer;
+  //Counters of the connection
+  struct bcp_stats stats;
+  
+  //The delivery ring and analytics; NULL until the connection becomes a sink
+  struct bcp_sink_state *sink;
+  
+#if BCP_CODEC
+  //Payload codec state of the packets of this node
+  struct codec_tx codec_tx;
+#endif
+  
+  //The channel of the broadcast connection; names the checkpoint file
+  uint16_t channel;
+  
+  //Telemetry reports to forward; the congestion map on sinks. Relays need
+  //it as well, so it is not part of the sink state
+  struct telemetry_table telemetry;
+  //Queue high-water mark since the last report, and the counters at the last report
+  uint16_t telemetry_peak;
+  uint32_t telemetry_retx;
+  uint32_t telemetry_drops;
+  uint32_t telemetry_churn;
+  //The neighbor which the last data frame was sent to
+  rimeaddr_t last_next_hop;
+  
+  //An overheard data packet this node may take and its sender; it is taken 
+  //at BCP_EVENT_ANYCAST (see BCP_OPPORTUNISTIC)
+  struct bcp_queue_item anycast_item;
+  rimeaddr_t anycast_from;
+  bool anycast_pending;
   
-  // Timer for retransmissions
-  struct ctimer retransmission_timer;
+  //The timed events of the connection: data, beacons, retransmissions, 
+  //telemetry, checkpoints... (BCP_EVENT_*)
+  struct bcp_scheduler events;
   
   // Timer for measuring the amount of time took to send the current packet
   struct timer delay_timer;
   
-  //Queue for the waiting packets
-  LIST_STRUCT(packet_queue_list);
-  struct bcp_queue packet_queue;
+  //Queues for the waiting packets; one per traffic class
+  struct bcp_queue packet_queue[BCP_TRAFFIC_CLASSES];
 
   // Routing table of neighbors
   LIST_STRUCT(routing_table_list);
   struct routingtable routing_table;
   
-  //Counts tx attempts achieved so far to send the current packet 
+  //Counts the transmissions of the current packet to the current neighbor;
+  //reset when either changes
   uint16_t tx_attempts;
   
+  //When the current data frame was handed to the broadcast channel
+  clock_time_t tx_start;
+  //When the current data frame left the radio; the wait for its ACK starts
+  clock_time_t ack_wait_start;
+  //Whether the packets wait for a routable neighbor, and since when
+  bool no_route;
+  clock_time_t no_route_since;
+  
+  //The queue item of the data packet which has been sent last and waits for an ACK
+  struct bcp_queue_item *tx_item;
+  
+  //Sequence number of the next packet generated by this node
+  uint16_t tx_seqno;
+  
+  //The data packets accepted last, from any neighbor. A retransmission of 
+  //one of them means that our ACK got lost
+  struct bcp_received rx_recent[BCP_DUPLICATE_CACHE];
+  //The record replaced next
+  uint8_t rx_recent_next;
+  
   
 };
 
@@ -97,16 +360,55 @@ struct bcp_conn {
 * \param c	A pointer to a struct bcp_conn
 * \param channel The channel number to be used for this connection.
 * \param cb   A pointer to the callbacks used for this connection
+* \param config The settings of the connection, or NULL for the defaults. 
+*             Invalid settings are replaced by the defaults.
 *		
 *	      This function opens a bcp connection on the
 *             specified channel. The BCP connection will use two channel ports 
 *            (channel, and channel+1). The callbacks are called when a
 *             packet is received (check \ref "struct bcp_callbacks").
 *
+*             The neighbors saved by the last checkpoint of the connection are
+*             restored and asked to confirm with a beacon request.
+*
+* \return     1 if the connection has been opened, or 0 if BCP_MAX_CONNECTIONS 
+*             connections are open already. The connection is not opened then.
 */
-void bcp_open(struct bcp_conn *c, uint16_t channel,
-              const struct bcp_callbacks *callbacks
-              );
+int bcp_open(struct bcp_conn *c, uint16_t channel,
+             const struct bcp_callbacks *callbacks,
+             const struct bcp_config *config
+             );
+
+/**
+ * \brief Fills the given settings with the defaults of bcp-config.h.
+ */
+void bcp_config_default(struct bcp_config *config);
+
+/**
+ * \brief Checks the given settings.
+ * \return true if every field is within its bounds (see \ref "struct bcp_config")
+ */
+bool bcp_config_check(const struct bcp_config *config);
+
+/**
+ * \brief Changes the settings of an opened bcp connection.
+ * \param c the opened bcp connection
+ * \param config the new settings
+ * \return 1 if they are valid and have been applied. Otherwise, 0 and nothing changes.
+ * 
+ *        Timers which are running keep their period until they expire. 
+ *        Lowered sizes apply to new packets and neighbors; the ones already 
+ *        stored are kept. Changing V restarts its tuning from the new value.
+ *        BCP only routes towards the sinks, so settings sent from a remote 
+ *        node reach this one through a protocol of the application, which 
+ *        then calls this function.
+ */
+int bcp_set_config(struct bcp_conn *c, const struct bcp_config *config);
+
+/**
+ * \return the current settings of the given bcp connection
+ */
+const struct bcp_config *bcp_get_config(struct bcp_conn *c);
 
 /**
 * \brief      Close an opened bcp connection
@@ -121,24 +423,139 @@ void bcp_close(struct bcp_conn *c);
 /**
 * \brief      Send a packet using the given bcp connection.
 * \param c    A pointer to a struct bcp_conn that has previously been opened with bcp_open().
-* \retval     Non-zero if the packet can be sent, zero otherwise.
+* \param tclass The traffic class of the packet (BCP_CLASS_HIGHEST .. BCP_CLASS_LOWEST).
+* \retval     The handle of the packet, which the completed callback reports, or 
+*             BCP_HANDLE_NONE if the packet cannot be sent.
 *             
 *	      This function sends a packet from the packetbuf on the
 *             given bcp connection. The packet must be present in the packetbuf
 *             before this function is called.
 *
+*             Every traffic class has its own queue and backlog, and 
+*             is routed along its own backpressure gradient. The order in which
+*             the classes are served is defined by BCP_CLASS_SCHEDULING.
+*
 *             The parameter c must point to a bcp connection that
 *             must have previously been set up with bcp_open().
 *
 */
-int bcp_send(struct bcp_conn *c);
+int bcp_send(struct bcp_conn *c, uint8_t tclass);
 
 
 /**
  * \brief Sets whether the current node is sink for the given bcp connection or not.
  * \param c the opened bcp connection
  * \param isSink true if the current node is sink. Otherwise, false.
+ * 
+ *        Several nodes of the same network can be sinks. Sinks always 
+ *        advertise a zero backlog, so every packet is collected by whichever 
+ *        sink the backpressure gradient leads to (anycast). Packets waiting in
+ *        the queues of a node which becomes a sink are delivered locally.
+ * \return 1 on success. 0 if the connection cannot become a sink because 
+ *        BCP_MAX_SINKS connections are sinks already; nothing changes then.
+ */
+int bcp_set_sink(struct bcp_conn *c, bool isSink);
+
+/**
+ * \brief Returns the number of data packets this sink delivered to the user.
+ * \param c the opened bcp connection
+ * 
+ *        In a network with several sinks, every sink reports its own share
+ *        of the collected traffic. The counter has a single writer and can be
+ *        read from any thread without locking. It is the delivered field of 
+ *        the statistics of the connection.
+ */
+uint32_t bcp_sink_delivered(struct bcp_conn *c);
+
+/**
+ * \brief Returns the delivery statistics of an origin collected by this sink.
+ * \param c the opened bcp connection
+ * \param origin the node which generated the packets
+ * \return the statistics, or NULL if no packet of the origin has been delivered
+ * 
+ *        Loss is estimated from the gaps between sequence numbers; the 
+ *        loss rate of an origin is lost / (received + lost).
+ */
+const struct bcp_origin_stats *bcp_sink_origin_stats(struct bcp_conn *c, 
+                                                     const rimeaddr_t *origin);
+
+/**
+ * \brief Iterates over the origins tracked by this sink.
+ * \param c the opened bcp connection
+ * \param index from 0 to BCP_SINK_MAX_ORIGINS - 1
+ * \return the statistics stored at index, or NULL if the entry is not used
+ */
+const struct bcp_origin_stats *bcp_sink_origin_at(struct bcp_conn *c, uint8_t index);
+
+/**
+ * \brief Prints the delivery statistics of every origin of this sink.
+ * \param c the opened bcp connection
+ * 
+ *        A sink also prints them every BCP_SINK_DUMP_TIME.
+ */
+void bcp_sink_stats_dump(struct bcp_conn *c);
+
+/**
+ * \brief Forgets the delivery statistics of this sink.
+ * \param c the opened bcp connection
+ */
+void bcp_sink_stats_reset(struct bcp_conn *c);
+
+/**
+ * \brief Returns a telemetry report collected by this sink.
+ * \param c the opened bcp connection
+ * \param index from 0 to BCP_TELEMETRY_MAX_REPORTS - 1
+ * \param age set to the time since the report was received
+ * \return the report stored at index, or NULL if the entry is not used
+ * 
+ *        Every node sends a report every BCP_TELEMETRY_TIME. A sink keeps the 
+ *        latest report of every node and prints them with its delivery 
+ *        statistics.
+ */
+const struct bcp_telemetry *bcp_sink_telemetry_at(struct bcp_conn *c, uint8_t index,
+                                                  clock_time_t *age);
+
+/**
+ * \brief Copies the statistics of the given bcp connection.
+ * \param c the opened bcp connection
+ * \param stats the structure to fill
+ */
+void bcp_stats_snapshot(struct bcp_conn *c, struct bcp_stats *stats);
+
+/**
+ * \brief Resets the statistics of the given bcp connection.
+ * \param c the opened bcp connection
+ * 
+ *        All the counters are set to zero. The high-water marks restart from
+ *        the current queue lengths.
+ */
+void bcp_stats_reset(struct bcp_conn *c);
+
+/**
+ * \brief Gives access to the packets waiting in the delivery ring of a sink.
+ * \param c the opened bcp connection
+ * \param entries set to the oldest waiting delivery
+ * \return the number of deliveries which can be read in place from entries
+ * 
+ *        The returned entries are contiguous in memory and stay valid until 
+ *        they are released with bcp_sink_release(). When the ring wraps, 
+ *        fewer entries than waiting are returned; call this function again 
+ *        after releasing them.
+ * 
+ *        The ring has a single producer (the bcp connection) and a single 
+ *        consumer. On hosts with atomics (e.g. a Linux gateway), the consumer
+ *        may be another thread than the one running the connection.
+ */
+uint16_t bcp_sink_peek(struct bcp_conn *c, const struct bcp_delivery **entries);
+
+/**
+ * \brief Releases the oldest deliveries of the ring of a sink.
+ * \param c the opened bcp connection
+ * \param count the number of deliveries which have been consumed
+ * 
+ *        While the ring is full, the sink does not acknowledge new packets, 
+ *        so they remain queued in its neighbors.
  */
-void bcp_set_sink(struct bcp_conn *c, bool isSink);
+void bcp_sink_release(struct bcp_conn *c, uint16_t count);
 
 #endif /* __BCP_H__ */
\ No newline at end of file
@@ -0,0 +1,132 @@
+/**
+ * \file
+ *         The default implementation of the routing table checkpoints (see \ref bcp_checkpoint.h).
+ *
+ *         The file of a connection is named after its channel and the address
+ *         of the node, so the nodes of a native simulation which share a 
+ *         directory do not restore each other's neighbors. It starts with a
+ *         header followed by one fixed-size record per neighbor.
+ */
+#include "bcp_checkpoint.h"
+
+#include "cfs/cfs.h"
+#include <stdio.h>
+#include <string.h>
+
+#define DEBUG 0
+#if DEBUG
+#define PRINTF(...) printf(__VA_ARGS__)
+#else
+#define PRINTF(...)
+#endif
+
+
+/*********************************DECLARATIONS*********************************/
+//Changed whenever the layout of the file changes
+#define CHECKPOINT_VERSION  1
+//Room for "bcp_rt_<channel>_<address in hex>"
+#define CHECKPOINT_NAME_SIZE    (14 + 2 * RIMEADDR_SIZE)
+
+/**
+ * \brief      The header of a checkpoint file
+ */
+struct checkpoint_header {
+  uint8_t version;
+  //Number of records
+  uint8_t count;
+};
+
+/**
+ * \brief      The checkpoint of a neighbor
+ */
+struct checkpoint_record {
+  rimeaddr_t neighbor;
+  uint8_t isSink;
+  uint16_t backpressure[BCP_TRAFFIC_CLASSES];
+  //State of the weight estimator (see \ref weight_estimator_save())
+  uint8_t state[BCP_CHECKPOINT_STATE_SIZE];
+};
+
+
+/*********************************UTILITIES************************************/
+static void checkpoint_name(struct bcp_conn *c, char *name, uint8_t len){
+    int n = snprintf(name, len, "bcp_rt_%u_", c->channel);
+    uint8_t k;
+    
+    for(k = 0; k < RIMEADDR_SIZE && n > 0 && n < len; k++)
+        n += snprintf(name + n, len - n, "%02x", rimeaddr_node_addr.u8[k]);
+}
+
+
+/*********************************PUBLIC FUNCTIONS*****************************/
+void checkpoint_save(struct bcp_conn *c){
+    struct checkpoint_header hdr;
+    struct checkpoint_record r;
+    struct routingtable_item *i;
+    char name[CHECKPOINT_NAME_SIZE];
+    int fd;
+
+    checkpoint_name(c, name, sizeof(name));
+    hdr.version = CHECKPOINT_VERSION;
+    hdr.count = 0;
+    for(i = list_head(*c->routing_table.list); i != NULL; i = list_item_next(i))
+        if(!i->provisional)
+            hdr.count++;
+    //Keep the previous checkpoint rather than an empty one
+    if(hdr.count == 0)
+        return;
+
+    cfs_remove(name);
+    fd = cfs_open(name, CFS_WRITE);
+    if(fd < 0){
+        PRINTF("ERROR: Cannot open the checkpoint file %s\n", name);
+        return;
+    }
+
+    cfs_write(fd, &hdr, sizeof(struct checkpoint_header));
+    for(i = list_head(*c->routing_table.list); i != NULL; i = list_item_next(i)){
+        if(i->provisional)
+            continue;
+        memset(&r, 0, sizeof(struct checkpoint_record));
+        rimeaddr_copy(&r.neighbor, &i->neighbor);
+        r.isSink = i->isSink;
+        memcpy(r.backpressure, i->backpressure, sizeof(r.backpressure));
+        weight_estimator_save(i, r.state, sizeof(r.state));
+        cfs_write(fd, &r, sizeof(struct checkpoint_record));
+    }
+    cfs_close(fd);
+    PRINTF("DEBUG: Saved %d neighbors to %s\n", hdr.count, name);
+}
+
+int checkpoint_restore(struct bcp_conn *c){
+    struct checkpoint_header hdr;
+    struct checkpoint_record r;
+    struct routingtable_item *i;
+    char name[CHECKPOINT_NAME_SIZE];
+    int restored = 0;
+    int fd;
+    uint8_t k;
+
+    checkpoint_name(c, name, sizeof(name));
+    fd = cfs_open(name, CFS_READ);
+    if(fd < 0)
+        return 0;
+
+    if(cfs_read(fd, &hdr, sizeof(struct checkpoint_header)) == sizeof(struct checkpoint_header)
+            && hdr.version == CHECKPOINT_VERSION){
+        for(k = 0; k < hdr.count; k++){
+            if(cfs_read(fd, &r, sizeof(struct checkpoint_record)) != sizeof(struct checkpoint_record))
+                break;
+            if(routing_table_update_queuelog(&c->routing_table, &r.neighbor, r.backpressure) < 0)
+                break;
+            i = routing_table_find(&c->routing_table, &r.neighbor);
+            i->isSink = r.isSink;
+            i->provisional = true;
+            weight_estimator_restore(i, r.state, sizeof(r.state));
+            restored++;
+        }
+    }
+    cfs_close(fd);
+    PRINTF("DEBUG: Restored %d neighbors from %s\n", restored, name);
+    return restored;
+}
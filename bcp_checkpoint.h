@@ -0,0 +1,28 @@
+/**
+ * \file
+ *         Header file for the routing table checkpoints.
+ *
+ *         A bcp connection periodically saves the neighbors of its routing
+ *         table and their weight estimator state to a CFS file (a plain file 
+ *         on the native platform). When the connection is opened again, e.g. 
+ *         after a reboot or a firmware update, the saved neighbors are 
+ *         restored as provisional entries and confirmed by a beacon request, 
+ *         so the node can forward packets right away.
+ */
+#ifndef __BCP_CHECKPOINT_H__
+#define __BCP_CHECKPOINT_H__
+
+#include "bcp.h"
+
+/**
+ * \breif Saves the confirmed neighbors of the routing table of the given connection.
+ */
+void checkpoint_save(struct bcp_conn *c);
+
+/**
+ * \breif Restores the neighbors saved by the given connection as provisional entries.
+ * \return the number of restored neighbors
+ */
+int checkpoint_restore(struct bcp_conn *c);
+
+#endif /* __BCP_CHECKPOINT_H__ */
@@ -0,0 +1,200 @@
+/**
+ * \file
+ *         The default implementation of the payload codec (see \ref bcp_codec.h).
+ *
+ *         The key ids cycle over 6 bits, so a sink matches a delta with the
+ *         key frame it was encoded against as long as it keeps fewer than 64
+ *         key frames per origin.
+ */
+#include "bcp_codec.h"
+
+#include <string.h>
+
+#define DEBUG 0
+#if DEBUG
+#include <stdio.h>
+#define PRINTF(...) printf(__VA_ARGS__)
+#else
+#define PRINTF(...)
+#endif
+
+
+/*********************************UTILITIES************************************/
+/**
+ * \return the byte of the payload XORed with the key frame
+ */
+static uint8_t delta_at(const struct codec_tx *t, const uint8_t *in, uint16_t pos){
+    return in[pos] ^ (pos < t->key_length ? t->key[pos] : 0);
+}
+
+/**
+ * \breif Encodes a payload as a delta against the last key frame.
+ * \return the length of the delta, or -1 if it is not smaller than a key frame
+ */
+static int encode_delta(const struct codec_tx *t, const uint8_t *in, uint16_t len,
+                        uint8_t *out){
+    uint16_t limit = len + CODEC_OVERHEAD;
+    uint16_t pos = 0;
+    uint16_t o = 2;
+    uint16_t start;
+    uint8_t zeros, changed, k;
+
+    out[0] = CODEC_DELTA | t->key_id;
+    out[1] = len;
+    while(pos < len){
+        for(zeros = 0; pos < len && zeros < 0xFF && delta_at(t, in, pos) == 0; zeros++)
+            pos++;
+        if(pos >= len)
+            break;
+        start = pos;
+        for(changed = 0; pos < len && changed < 0xFF && delta_at(t, in, pos) != 0; changed++)
+            pos++;
+        if(o + 2 + changed >= limit)
+            return -1;
+        out[o++] = zeros;
+        out[o++] = changed;
+        for(k = 0; k < changed; k++)
+            out[o++] = delta_at(t, in, start + k);
+    }
+    return o < limit ? o : -1;
+}
+
+/**
+ * \return the key frames of the given origin. A new origin takes a free
+ *         record, or replaces one when the table is full
+ */
+static struct codec_origin *find_or_add(struct codec_rx *r, const rimeaddr_t *origin){
+    struct codec_origin *slot = NULL;
+    uint8_t k;
+
+    for(k = 0; k < BCP_SINK_MAX_ORIGINS; k++){
+        if(!r->origins[k].used){
+            if(slot == NULL)
+                slot = &r->origins[k];
+        }else if(rimeaddr_cmp(&r->origins[k].origin, origin)){
+            return &r->origins[k];
+        }
+    }
+    if(slot == NULL){
+        slot = &r->origins[r->evict];
+        r->evict = (r->evict + 1) % BCP_SINK_MAX_ORIGINS;
+    }
+    memset(slot, 0, sizeof(struct codec_origin));
+    rimeaddr_copy(&slot->origin, origin);
+    slot->used = true;
+    return slot;
+}
+
+/**
+ * \return the key frame of the given origin with the given id, or NULL
+ */
+static struct codec_key *find_key(struct codec_rx *r, const rimeaddr_t *origin,
+                                  uint8_t id){
+    struct codec_origin *o;
+    uint8_t k, j;
+
+    for(k = 0; k < BCP_SINK_MAX_ORIGINS; k++){
+        o = &r->origins[k];
+        if(!o->used || !rimeaddr_cmp(&o->origin, origin))
+            continue;
+        for(j = 0; j < BCP_CODEC_KEYS; j++)
+            if(o->keys[j].used && o->keys[j].id == id)
+                return &o->keys[j];
+        return NULL;
+    }
+    return NULL;
+}
+
+
+/*********************************PUBLIC FUNCTIONS*****************************/
+void codec_tx_init(struct codec_tx *t){
+    memset(t, 0, sizeof(struct codec_tx));
+}
+
+void codec_rx_init(struct codec_rx *r){
+    memset(r, 0, sizeof(struct codec_rx));
+}
+
+uint16_t codec_encode(struct codec_tx *t, const uint8_t *in, uint16_t len,
+                      uint8_t *out){
+    int n = -1;
+
+    if(t->since_key > 0 && t->since_key < BCP_CODEC_KEY_INTERVAL)
+        n = encode_delta(t, in, len, out);
+    if(n >= 0){
+        t->since_key++;
+        return n;
+    }
+
+    //Key frame
+    t->key_id = (t->key_id + 1) & CODEC_ID_MASK;
+    memcpy(t->key, in, len);
+    t->key_length = len;
+    t->since_key = 1;
+    out[0] = CODEC_KEY | t->key_id;
+    memcpy(out + CODEC_OVERHEAD, in, len);
+    return len + CODEC_OVERHEAD;
+}
+
+int codec_decode(struct codec_rx *r, const rimeaddr_t *origin,
+                 const uint8_t *in, uint16_t len, uint8_t *out){
+    struct codec_origin *o;
+    struct codec_key *key;
+    uint8_t id;
+    uint16_t n, pos, i, k;
+    uint8_t changed;
+
+    if(len < CODEC_OVERHEAD)
+        return -1;
+    id = in[0] & CODEC_ID_MASK;
+
+    switch(in[0] & CODEC_TYPE_MASK){
+    case CODEC_KEY:
+        n = len - CODEC_OVERHEAD;
+        if(n > MAX_USER_PACKET_SIZE)
+            return -1;
+        o = find_or_add(r, origin);
+        key = &o->keys[o->next];
+        o->next = (o->next + 1) % BCP_CODEC_KEYS;
+        memcpy(key->data, in + CODEC_OVERHEAD, n);
+        key->length = n;
+        key->id = id;
+        key->used = true;
+        memcpy(out, key->data, n);
+        return n;
+
+    case CODEC_DELTA:
+        if(len < 2 || in[1] > MAX_USER_PACKET_SIZE)
+            return -1;
+        key = find_key(r, origin, id);
+        if(key == NULL){
+            PRINTF("DEBUG: Key frame %d of node[%d].[%d] is missing\n", id,
+                    origin->u8[0], origin->u8[1]);
+            return -1;
+        }
+        n = in[1];
+        for(pos = 0; pos < n; pos++)
+            out[pos] = pos < key->length ? key->data[pos] : 0;
+        pos = 0;
+        for(i = 2; i + 2 <= len; ){
+            pos += in[i++];
+            changed = in[i++];
+            if(i + changed > len || pos + changed > n)
+                return -1;
+            for(k = 0; k < changed; k++)
+                out[pos++] ^= in[i++];
+        }
+        return n;
+
+    default:
+        return -1;
+    }
+}
+
+bool codec_key_of(const uint8_t *key, uint16_t key_len, const uint8_t *delta,
+                  uint16_t delta_len){
+    return key_len >= CODEC_OVERHEAD && delta_len >= CODEC_OVERHEAD
+            && (key[0] & CODEC_TYPE_MASK) == CODEC_KEY
+            && (delta[0] & CODEC_TYPE_MASK) == CODEC_DELTA
+            && (key[0] & CODEC_ID_MASK) == (delta[0] & CODEC_ID_MASK);
+}
@@ -0,0 +1,127 @@
+/**
+ * \file
+ *         Header file for the payload codec.
+ *
+ *         Origins which send slowly changing readings send most of them as
+ *         deltas against their last key frame: the bytes which differ, XORed
+ *         with the key, run-length encoded. A key frame is sent every
+ *         BCP_CODEC_KEY_INTERVAL packets, or when the delta would not be
+ *         smaller. Sinks keep the last BCP_CODEC_KEYS key frames of every
+ *         origin and rebuild the readings. A delta whose key frame has not
+ *         reached the sink cannot be rebuilt; the key interval bounds the loss.
+ *         The queues are LIFO, so the deltas of a key frame are on top of it;
+ *         the nodes send the key frame first (see codec_key_of()).
+ *
+ *         Every encoded payload starts with one byte: the frame type in the
+ *         two upper bits and the key id in the others. A key frame follows
+ *         with the payload. A delta follows with the length of the payload
+ *         (MAX_USER_PACKET_SIZE may not exceed 255) and a list of 
+ *         <unchanged bytes> <changed bytes> <XORed changed bytes...> runs.
+ *         Unchanged bytes at the end are not sent.
+ */
+#ifndef __BCP_CODEC_H__
+#define __BCP_CODEC_H__
+
+#include <stdbool.h>
+//The host test (bcp_codec_test.c) brings its own addresses
+#ifndef BCP_CODEC_HOST
+#include "net/rime.h"
+#endif
+#include "bcp-config.h"
+
+//Frame types
+#define CODEC_KEY       0x40
+#define CODEC_DELTA     0x80
+#define CODEC_TYPE_MASK 0xC0
+#define CODEC_ID_MASK   0x3F
+
+//Bytes added to a payload by the codec
+#define CODEC_OVERHEAD  1
+
+/**
+ * \brief      The encoder state of an origin
+ */
+struct codec_tx {
+  //The last key frame
+  uint8_t key[MAX_USER_PACKET_SIZE];
+  uint16_t key_length;
+  uint8_t key_id;
+  //Packets encoded since the last key frame; 0 when there is no key frame yet
+  uint8_t since_key;
+};
+
+/**
+ * \brief      A key frame kept by a sink
+ */
+struct codec_key {
+  uint8_t data[MAX_USER_PACKET_SIZE];
+  uint16_t length;
+  uint8_t id;
+  bool used;
+};
+
+/**
+ * \brief      The key frames of an origin kept by a sink
+ */
+struct codec_origin {
+  rimeaddr_t origin;
+  struct codec_key keys[BCP_CODEC_KEYS];
+  //The slot of the next key frame
+  uint8_t next;
+  bool used;
+};
+
+/**
+ * \brief      The decoder state of a sink
+ */
+struct codec_rx {
+  struct codec_origin origins[BCP_SINK_MAX_ORIGINS];
+  //The record replaced when a new origin does not fit
+  uint8_t evict;
+};
+
+/**
+ * \breif Clears the encoder state; the next packet is a key frame.
+ */
+void codec_tx_init(struct codec_tx *t);
+
+/**
+ * \breif Clears the decoder state.
+ */
+void codec_rx_init(struct codec_rx *r);
+
+/**
+ * \breif Encodes a payload.
+ * \param t the encoder state of this node
+ * \param in the payload
+ * \param len the length of the payload, at most MAX_USER_PACKET_SIZE - CODEC_OVERHEAD
+ * \param out the encoded payload; MAX_USER_PACKET_SIZE bytes. It may not overlap in
+ * \return the length of the encoded payload
+ */
+uint16_t codec_encode(struct codec_tx *t, const uint8_t *in, uint16_t len,
+                      uint8_t *out);
+
+/**
+ * \breif Decodes a payload.
+ * \param r the decoder state of this sink
+ * \param origin the node which encoded the payload
+ * \param in the encoded payload
+ * \param len the length of the encoded payload
+ * \param out the payload; MAX_USER_PACKET_SIZE bytes. It may not overlap in
+ * \return the length of the payload, or -1 if it cannot be decoded
+ */
+int codec_decode(struct codec_rx *r, const rimeaddr_t *origin,
+                 const uint8_t *in, uint16_t len, uint8_t *out);
+
+/**
+ * \breif Tells whether a payload is the key frame a delta was encoded against.
+ *        Both must come from the same origin.
+ * \param key the encoded payload which may be the key frame
+ * \param key_len its length
+ * \param delta the encoded payload which may be the delta
+ * \param delta_len its length
+ */
+bool codec_key_of(const uint8_t *key, uint16_t key_len, const uint8_t *delta,
+                  uint16_t delta_len);
+
+#endif /* __BCP_CODEC_H__ */
@@ -8,6 +8,7 @@
 #ifndef BCP_EXTENDER_H
 #define	BCP_EXTENDER_H
 
+struct bcp_conn;
 
 
 /** 
@@ -0,0 +1,308 @@
+/**
+ * \file
+ *         The trace-driven link model of the UDP multicast radio (see \ref bcp_link_trace.h).
+ *
+ *         The trace is read line by line as the clock advances. Only the
+ *         latest state of the links towards this node is kept. Every decision
+ *         is written to the record file. A replay takes the decisions from a
+ *         record instead of drawing them. Frames are identified by their
+ *         sender and the sequence number the sender gave them, so a replay
+ *         hears exactly the frames the recorded run heard.
+ */
+#include "bcp_link_trace.h"
+
+#include "contiki.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#define DEBUG 0
+#if DEBUG
+#define PRINTF(...) printf(__VA_ARGS__)
+#else
+#define PRINTF(...)
+#endif
+
+
+/*********************************DECLARATIONS*********************************/
+/**
+ * \brief      The current state of an incoming link
+ */
+struct link_state {
+  //The neighbor at the other end of the link
+  rimeaddr_t sender;
+  //Packet reception ratio in percent
+  uint8_t prr;
+  //Received signal strength
+  int16_t rssi;
+  bool used;
+};
+
+/**
+ * \brief      A line of the link trace
+ */
+struct trace_event {
+  unsigned long ms;
+  rimeaddr_t sender;
+  rimeaddr_t receiver;
+  int prr;
+  int rssi;
+};
+
+/**
+ * \brief      A reception decision read from a record
+ */
+struct replay_event {
+  rimeaddr_t sender;
+  uint16_t seqno;
+  int16_t rssi;
+  bool heard;
+  bool valid;
+};
+
+static struct link_state links[BCP_LINK_TRACE_MAX_LINKS];
+
+static FILE *trace_file;
+static struct trace_event next_event;
+static bool has_next_event;
+
+static FILE *record_file;
+
+static FILE *replay_file;
+static struct replay_event replay_window[BCP_LINK_REPLAY_WINDOW];
+static uint16_t replay_next;
+
+static uint32_t rng_state = 1;
+
+
+/*********************************UTILITIES************************************/
+/**
+ * \return the time since the node started, in milliseconds
+ */
+static unsigned long now_ms(void){
+    return (unsigned long) clock_time() * 1000 / CLOCK_SECOND;
+}
+
+/**
+ * \return the next number of the loss process (xorshift32)
+ */
+static uint32_t next_random(void){
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+/**
+ * \breif Opens the per-node file <prefix>.<a>.<b>
+ */
+static FILE *open_node_file(const char *prefix, const char *mode){
+    char name[256];
+    snprintf(name, sizeof(name), "%s.%d.%d", prefix,
+            rimeaddr_node_addr.u8[0], rimeaddr_node_addr.u8[1]);
+    return fopen(name, mode);
+}
+
+/**
+ * \breif Reads the next valid line of the trace into next_event.
+ */
+static void read_trace_event(void){
+    char line[128];
+    unsigned int s0, s1, r0, r1;
+
+    has_next_event = false;
+    while(fgets(line, sizeof(line), trace_file) != NULL){
+        if(sscanf(line, "%lu %u.%u %u.%u %d %d", &next_event.ms, &s0, &s1,
+                  &r0, &r1, &next_event.prr, &next_event.rssi) != 7)
+            continue;
+        next_event.sender.u8[0] = s0;
+        next_event.sender.u8[1] = s1;
+        next_event.receiver.u8[0] = r0;
+        next_event.receiver.u8[1] = r1;
+        has_next_event = true;
+        return;
+    }
+}
+
+/**
+ * \return the state of the link from the given sender, or NULL if the trace
+ *         did not describe it yet
+ */
+static struct link_state *find_link(const rimeaddr_t *sender){
+    int k;
+    for(k = 0; k < BCP_LINK_TRACE_MAX_LINKS; k++)
+        if(links[k].used && rimeaddr_cmp(&links[k].sender, sender))
+            return &links[k];
+    return NULL;
+}
+
+/**
+ * \breif Applies the trace lines whose time has come.
+ */
+static void advance_trace(void){
+    struct link_state *l;
+    unsigned long now = now_ms();
+    int k;
+
+    while(has_next_event && next_event.ms <= now){
+        if(rimeaddr_cmp(&next_event.receiver, &rimeaddr_node_addr)){
+            l = find_link(&next_event.sender);
+            for(k = 0; l == NULL && k < BCP_LINK_TRACE_MAX_LINKS; k++)
+                if(!links[k].used)
+                    l = &links[k];
+            if(l != NULL){
+                l->used = true;
+                rimeaddr_copy(&l->sender, &next_event.sender);
+                l->prr = next_event.prr < 0 ? 0 :
+                        (next_event.prr > 100 ? 100 : next_event.prr);
+                l->rssi = next_event.rssi;
+            }else{
+                PRINTF("ERROR: Link table is full; increase BCP_LINK_TRACE_MAX_LINKS\n");
+            }
+        }
+        read_trace_event();
+    }
+}
+
+/**
+ * \breif Reads the next reception decision of the replayed record.
+ * \return false at the end of the record
+ */
+static bool read_replay_event(struct replay_event *e){
+    char line[128];
+    unsigned long ms;
+    char type;
+    unsigned int s0, s1, seqno, len;
+    int rssi;
+
+    while(fgets(line, sizeof(line), replay_file) != NULL){
+        if(sscanf(line, "%lu %c %u.%u %u %u %d", &ms, &type, &s0, &s1, &seqno,
+                  &len, &rssi) != 7 || (type != 'R' && type != 'L'))
+            continue;
+        e->sender.u8[0] = s0;
+        e->sender.u8[1] = s1;
+        e->seqno = seqno;
+        e->rssi = rssi;
+        e->heard = type == 'R';
+        e->valid = true;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * \breif Returns the slot of the replay window the next event is read into.
+ *
+ *      Slots of events which are still waiting for their frame are skipped.
+ *      When the window is full, the oldest event is forgotten.
+ */
+static struct replay_event *replay_slot(void){
+    struct replay_event *e;
+    int k;
+
+    for(k = 0; k < BCP_LINK_REPLAY_WINDOW; k++){
+        e = &replay_window[replay_next];
+        replay_next = (replay_next + 1) % BCP_LINK_REPLAY_WINDOW;
+        if(!e->valid)
+            return e;
+    }
+    e = &replay_window[replay_next];
+    replay_next = (replay_next + 1) % BCP_LINK_REPLAY_WINDOW;
+    return e;
+}
+
+/**
+ * \breif Finds the recorded decision for the given frame.
+ * \return Non-zero if the frame was heard in the recorded run
+ */
+static int replay_accept(const rimeaddr_t *sender, uint16_t seqno, int16_t *rssi){
+    struct replay_event *e;
+    int k;
+
+    for(k = 0; k < BCP_LINK_REPLAY_WINDOW; k++){
+        e = &replay_window[k];
+        if(e->valid && e->seqno == seqno && rimeaddr_cmp(&e->sender, sender)){
+            e->valid = false;
+            *rssi = e->rssi;
+            return e->heard;
+        }
+    }
+
+    //Read ahead; frames which arrived much earlier in the record are forgotten
+    for(k = 0; k < BCP_LINK_REPLAY_WINDOW; k++){
+        e = replay_slot();
+        if(!read_replay_event(e))
+            break;
+        if(e->seqno == seqno && rimeaddr_cmp(&e->sender, sender)){
+            e->valid = false;
+            *rssi = e->rssi;
+            return e->heard;
+        }
+    }
+
+    //The recorded run never heard this frame
+    return 0;
+}
+
+
+/*********************************PUBLIC FUNCTIONS*****************************/
+void link_trace_init(void){
+    const char *name;
+
+    name = getenv("BCP_LINK_SEED");
+    rng_state = (name != NULL ? strtoul(name, NULL, 0) : 1)
+            ^ ((uint32_t) rimeaddr_node_addr.u8[0] << 8 | rimeaddr_node_addr.u8[1]) << 16;
+    if(rng_state == 0)
+        rng_state = 1;
+
+    name = getenv("BCP_LINK_TRACE");
+    if(name != NULL){
+        trace_file = fopen(name, "r");
+        if(trace_file != NULL){
+            read_trace_event();
+        }else{
+            PRINTF("ERROR: Cannot open the link trace %s\n", name);
+        }
+    }
+
+    name = getenv("BCP_LINK_RECORD");
+    if(name != NULL){
+        record_file = open_node_file(name, "w");
+        if(record_file != NULL)
+            setvbuf(record_file, NULL, _IOLBF, 0);
+    }
+
+    name = getenv("BCP_LINK_REPLAY");
+    if(name != NULL)
+        replay_file = open_node_file(name, "r");
+}
+
+int link_trace_accept(const rimeaddr_t *sender, uint16_t seqno, uint16_t len,
+                      int16_t *rssi){
+    struct link_state *l;
+    int heard = 1;
+
+    *rssi = 0;
+    if(replay_file != NULL){
+        heard = replay_accept(sender, seqno, rssi);
+    }else if(trace_file != NULL){
+        advance_trace();
+        l = find_link(sender);
+        if(l != NULL){
+            *rssi = l->rssi;
+            heard = next_random() % 100 < l->prr;
+        }
+    }
+
+    if(record_file != NULL)
+        fprintf(record_file, "%lu %c %d.%d %u %u %d\n", now_ms(), heard ? 'R' : 'L',
+                sender->u8[0], sender->u8[1], seqno, len, *rssi);
+    return heard;
+}
+
+void link_trace_sent(uint16_t seqno, uint16_t len){
+    if(record_file != NULL)
+        fprintf(record_file, "%lu T %d.%d %u %u 0\n", now_ms(),
+                rimeaddr_node_addr.u8[0], rimeaddr_node_addr.u8[1], seqno, len);
+}
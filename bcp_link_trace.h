@@ -0,0 +1,61 @@
+/**
+ * \file
+ *         Header file for the trace-driven link model of the UDP multicast radio.
+ *
+ *         On the native platform, the UDP radio delivers every frame to every
+ *         node. The link model decides instead which frames a node hears.
+ *         It uses per-link packet reception ratio (PRR) and RSSI time series
+ *         recorded in the field, and can record and replay these decisions.
+ *         It is configured with environment variables:
+ *
+ *         BCP_LINK_TRACE  a text file of "<ms> <src> <dst> <prr%> <rssi>" lines
+ *                         sorted by time, e.g. "1500 2.0 1.0 87 -71". The file
+ *                         is streamed, so it does not have to fit in memory.
+ *                         Links missing from the trace are perfect.
+ *         BCP_LINK_RECORD a file prefix; every node writes its frame events
+ *                         (sent, received, lost) to <prefix>.<node>.
+ *         BCP_LINK_REPLAY a file prefix of a previous record; received frames
+ *                         are heard or lost exactly as in the recorded run.
+ *         BCP_LINK_SEED   seed of the loss process (default 1).
+ */
+#ifndef __BCP_LINK_TRACE_H__
+#define __BCP_LINK_TRACE_H__
+
+#include "net/rime.h"
+
+//Number of incoming links whose current state is kept
+#ifndef BCP_LINK_TRACE_MAX_LINKS
+#define BCP_LINK_TRACE_MAX_LINKS 64
+#endif
+
+//Number of recorded events looked ahead while replaying
+#ifndef BCP_LINK_REPLAY_WINDOW
+#define BCP_LINK_REPLAY_WINDOW 256
+#endif
+
+/**
+ * \breif Opens the trace, record and replay files given by the environment.
+ */
+void link_trace_init(void);
+
+/**
+ * \breif Decides whether a received frame is heard by this node.
+ *
+ * \param sender the node which sent the frame
+ * \param seqno the sequence number the sender gave to the frame
+ * \param len the length of the frame
+ * \param rssi set to the RSSI of the link when the frame is heard
+ * \return Non-zero if the frame is heard. Otherwise, zero
+ */
+int link_trace_accept(const rimeaddr_t *sender, uint16_t seqno, uint16_t len,
+                      int16_t *rssi);
+
+/**
+ * \breif Records a frame sent by this node.
+ *
+ * \param seqno the sequence number of the frame
+ * \param len the length of the frame
+ */
+void link_trace_sent(uint16_t seqno, uint16_t len);
+
+#endif /* __BCP_LINK_TRACE_H__ */
@@ -21,10 +21,17 @@
 void bcp_queue_init(void *c){
     //Setup BCP
     struct bcp_conn * bcp_c = (struct bcp_conn *) c;
-    bcp_c->packet_queue.list = &(bcp_c->packet_queue_list);
-    bcp_c->packet_queue.bcp_connection = c;
+    struct bcp_queue * q;
+    uint8_t k;
     
-    list_init(bcp_c->packet_queue_list);
+    for(k = 0; k < BCP_TRAFFIC_CLASSES; k++){
+        q = &bcp_c->packet_queue[k];
+        LIST_STRUCT_INIT(q, list);
+        q->bcp_connection = c;
+        q->tclass = k;
+        q->length = 0;
+        q->virtual_backlog = 0;
+    }
     PRINTF("DEBUG: Bcp Queue has been initialized \n");
     
     /**
@@ -35,7 +42,7 @@ void bcp_queue_init(void *c){
 }
 
 struct bcp_queue_item * bcp_queue_top(struct bcp_queue *s){
-    return list_head(*s->list);
+    return list_head(s->list);
 }
 
 struct bcp_queue_item * bcp_queue_element(struct bcp_queue *s, uint16_t index){
@@ -54,8 +61,12 @@ void bcp_queue_remove(struct bcp_queue *s, struct bcp_queue_item *i){
    PRINTF("DEBUG: Removing an item from the packet queue\n");
    //Null is not allowed here
    if(i != NULL) {
-    list_remove(*s->list, i);
+    list_remove(s->list, i);
     memb_free(s->memb, i);
+    s->length--;
+    //A freed slot compensates one of the dropped packets
+    if(s->virtual_backlog > 0)
+        s->virtual_backlog--;
   }else{
        PRINTF("ERROR: Passed queue item record cannot be removed from the packet queue\n");
   }
@@ -68,7 +79,20 @@ void bcp_queue_pop(struct bcp_queue *s){
 }
 
 int bcp_queue_length(struct bcp_queue *s){
-    return list_length(*s->list);
+    return s->length;
+}
+
+uint16_t bcp_queue_backlog(struct bcp_queue *s){
+    return bcp_queue_length(s) + s->virtual_backlog;
+}
+
+/**
+ * Accounts a packet which is dropped because the queue has no room for it.
+ */
+static void bcp_queue_overflow(struct bcp_queue *s){
+    if(s->virtual_backlog < MAX_VIRTUAL_QUEUE_SIZE)
+        s->virtual_backlog++;
+    PRINTF("DEBUG: Virtual backlog increased to %d\n", s->virtual_backlog);
 }
 
 struct bcp_queue_item * bcp_queue_push(struct bcp_queue *s, struct bcp_queue_item *i){
@@ -76,30 +100,37 @@ struct bcp_queue_item * bcp_queue_push(struct bcp_queue *s, struct bcp_queue_ite
     
     //Make sure the queue is not full
     uint16_t current_queue_length =  bcp_queue_length(s);
-     if(current_queue_length + 1 > MAX_PACKET_QUEUE_SIZE){
+     if(current_queue_length + 1 
+             > ((struct bcp_conn *) s->bcp_connection)->config.queue_size){
         PRINTF("ERROR: Packet Queue is full, a new packet will be dropped \n");
+        bcp_queue_overflow(s);
         return NULL;
     }
     
     // Allocate a memory block for the new record
-    newRow = memb_alloc(s->memb);
+    newRow = s->memb != NULL ? memb_alloc(s->memb) : NULL;
   
      if(newRow == NULL) {
          PRINTF("DEBUG: Error, memory cannot be allocated for a bcp_queue_item record \n");
+         bcp_queue_overflow(s);
          return NULL;
      }
     
     
     //Sets the fields of the new record
     newRow->next = NULL;
-    newRow->hdr.bcp_backpressure = 0;
     newRow->data_length = i->data_length;
+    if(newRow->data_length > MAX_USER_PACKET_SIZE)
+        newRow->data_length = MAX_USER_PACKET_SIZE;
     
     memcpy(newRow->data, i->data, newRow->data_length);
+    memcpy(&newRow->hdr, &i->hdr, sizeof(struct bcp_packet_header));
+    newRow->hdr.tclass = s->tclass;
     
     
     //Add the row to the queue
-    list_push(*s->list, newRow);
+    list_push(s->list, newRow);
+    s->length++;
     
     PRINTF("DEBUG: Pushing a new data packet to the packet queue\n");
     return bcp_queue_top(s);
@@ -112,6 +143,7 @@ void bcp_queue_clear(struct bcp_queue *s){
   while(bcp_queue_top(s) != NULL) {
     bcp_queue_pop(s);
   }
+  s->virtual_backlog = 0;
   
   PRINTF("DEBUG: Packet Queue has been cleared\n");
 }
\ No newline at end of file
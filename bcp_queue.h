@@ -6,6 +6,7 @@
 #ifndef __BCP_QUEUE_H__
 #define __BCP_QUEUE_H__
 
+#include <stddef.h>
 #include "lib/list.h"
 #include "lib/memb.h"
 #include "net/packetbuf.h"
@@ -13,26 +14,47 @@
 
 /**
  * \brief      A structure defines a bcp queue
- *             Every BCP connection has one queue which is used to store user packets
- *             at runtime. 
+ *             Every BCP connection has one queue per traffic class which is used 
+ *             to store user packets at runtime. 
  */
 struct bcp_queue {
   //It is a list
-  list_t *list;
+  LIST_STRUCT(list);
   //Memory allocation
   struct memb *memb;
   //Parent BCP connection for the queue
   void* bcp_connection;
+  //The traffic class served by this queue
+  uint8_t tclass;
+  //Number of packets in the list
+  uint16_t length;
+  //Virtual backlog: packets dropped because the queue was full and not yet
+  //compensated by freed capacity (floating queue)
+  uint16_t virtual_backlog;
 };
 
+//Stages of the latency of a packet at every hop
+#define BCP_STAGE_QUEUE     0   // Waiting in the packet queue
+#define BCP_STAGE_NEIGHBOR  1   // Waiting for a routable neighbor
+#define BCP_STAGE_CHANNEL   2   // Waiting for the channel
+#define BCP_STAGE_ACK       3   // Waiting for an ACK, until the ACK or the next attempt
+#define BCP_HOP_STAGES      4
+
+//Value of anycast_backlog for packets which only the addressed neighbor may take
+#define BCP_ANYCAST_OFF     0xFFFF
+
 /**
  * \brief      A structure for the header part of bcp packets
  */
 struct bcp_packet_header {
     /**
-     * Backlog
+     * Backlog of the sender for every traffic class
+     */
+    uint16_t bcp_backpressure[BCP_TRAFFIC_CLASSES];
+    /**
+     * The traffic class of the packet
      */
-    uint16_t bcp_backpressure;
+    uint8_t tclass;
     /**
      * The addressed of the node which generated the packet
      */
@@ -45,6 +67,40 @@ struct bcp_packet_header {
      * last time this packet has been processed. Used to calculate the packet delay
      */
     clock_time_t lastProcessTime;
+    /**
+     * Number of hops the packet has travelled so far
+     */
+    uint8_t hops;
+    /**
+     * Number of hops between the sender and its closest sink
+     */
+    uint8_t sink_distance;
+    /**
+     * Backlog of the neighbor the frame is sent to. Other neighbors with a 
+     * backlog not larger may take the packet (see BCP_OPPORTUNISTIC). 
+     * BCP_ANYCAST_OFF if they may not
+     */
+    uint16_t anycast_backlog;
+    /**
+     * Sequence number given to the packet by its origin
+     */
+    uint16_t seqno;
+    /**
+     * Non-zero if the data is encoded with the payload codec (see BCP_CODEC)
+     */
+    uint8_t codec;
+    /**
+     * Transmissions of the packet by the node which queued it; saturates at 255
+     */
+    uint8_t attempts;
+#if BCP_HOP_SUMMARY
+    /**
+     * Time spent in every stage (BCP_STAGE_*), summed over the hops, in clock
+     * ticks. The stages of the last transmission of every hop are not known 
+     * when it is sent and are not counted.
+     */
+    uint16_t stage_delay[BCP_HOP_STAGES];
+#endif
 };
 
 /**
@@ -54,26 +110,30 @@ struct bcp_queue_item {
   //Linked list
   struct bcp_queue_item *next;
   /**
-   * The data section
+   * The header section
    */
-  char data[MAX_USER_PACKET_SIZE]; //Data
+  struct bcp_packet_header hdr; //Header
   /**
    * The length of the data section
    */
   uint16_t data_length;
   /**
-   * The header section
+   * The data section. It comes last so that frames end with the data
    */
-  struct bcp_packet_header hdr; //Header
+  char data[MAX_USER_PACKET_SIZE]; //Data
 };
 
+//Number of bytes of the given queue item sent on air
+#define BCP_FRAME_LENGTH(i)  (offsetof(struct bcp_queue_item, data) + (i)->data_length)
+
 /**
- * \breif Initializes the packet queue.
+ * \breif Initializes the packet queues.
  * 
- * \param c the BCP connection for the packet queue.
+ * \param c the BCP connection for the packet queues.
  * 
  *        This function has to be called before using any other bcp_queue_* functions.
  *        Packet queue is a data structure used to store user data packets at runtime. 
+ *        Every traffic class of the connection has its own packet queue.
  *        Packet queue needs to be initialized before using it to allocate necessary 
  *        memory allocation tasks. 
  */
@@ -99,8 +159,9 @@ struct bcp_queue_item * bcp_queue_element(struct bcp_queue *s, uint16_t index);
  * \return the record representation of the packet after being added to the queue.
  * 
  *          This function adds the given item to the queue. It uses memory copy API
- *          to copy the item into a new memory location. Thus, the parameter (i) can
- *          be local or released safely after calling this function.
+ *          to copy the item (data and header) into a new memory location. Thus, 
+ *          the parameter (i) can be local or released safely after calling this 
+ *          function.
  */
 struct bcp_queue_item * bcp_queue_push(struct bcp_queue *s, struct bcp_queue_item *i);
 
@@ -131,6 +192,20 @@ void bcp_queue_remove(struct bcp_queue *s, struct bcp_queue_item *i);
  */
 int bcp_queue_length(struct bcp_queue *s);
 
+/**
+ * \breif Returns the backlog advertised to the neighbors
+ * 
+ * \param s the packet queue
+ * \return the number of the packets existing in the given packet queue plus 
+ *         its virtual backlog.
+ * 
+ *      The virtual backlog grows by one every time a packet is dropped because 
+ *      the queue is full and shrinks by one every time a packet leaves the 
+ *      queue. Advertising it keeps the backpressure gradient meaningful when 
+ *      the offered load exceeds the queue size (floating queue).
+ */
+uint16_t bcp_queue_backlog(struct bcp_queue *s);
+
 /**
  * \breif Deletes all the records of the given packet queue
  * 
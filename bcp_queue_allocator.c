@@ -1,12 +1,76 @@
 #include "bcp.h"
 #include "bcp_queue.h"
-#include "bcp_queue_allocator.h" //To customize the queue item 
+#include "bcp_queue_allocator.h" //To customize the queue item
 
 
-//Memory allocation for the routing table. This is defined here because 
-MEMB(packet_queue_memb, struct bcp_queue_item, MAX_PACKET_QUEUE_SIZE);
+#define PACKET_QUEUE_POOL_SIZE  (MAX_PACKET_QUEUE_SIZE * BCP_TRAFFIC_CLASSES)
 
-void bcp_queue_allocator_init(struct bcp_conn *c){    
-    c->packet_queue.memb = &packet_queue_memb;
-    memb_init(&packet_queue_memb);
+#if BCP_MAX_CONNECTIONS > 4
+#error "At most 4 bcp connections are supported (BCP_MAX_CONNECTIONS)"
+#endif
+
+//The memory pools of the packet queues; one per bcp connection. Connections
+//do not share pools, so opening a connection never resets the queues of another.
+MEMB(packet_queue_memb0, struct bcp_queue_item, PACKET_QUEUE_POOL_SIZE);
+#if BCP_MAX_CONNECTIONS > 1
+MEMB(packet_queue_memb1, struct bcp_queue_item, PACKET_QUEUE_POOL_SIZE);
+#endif
+#if BCP_MAX_CONNECTIONS > 2
+MEMB(packet_queue_memb2, struct bcp_queue_item, PACKET_QUEUE_POOL_SIZE);
+#endif
+#if BCP_MAX_CONNECTIONS > 3
+MEMB(packet_queue_memb3, struct bcp_queue_item, PACKET_QUEUE_POOL_SIZE);
+#endif
+
+static struct memb * const packet_queue_membs[BCP_MAX_CONNECTIONS] = {
+  &packet_queue_memb0,
+#if BCP_MAX_CONNECTIONS > 1
+  &packet_queue_memb1,
+#endif
+#if BCP_MAX_CONNECTIONS > 2
+  &packet_queue_memb2,
+#endif
+#if BCP_MAX_CONNECTIONS > 3
+  &packet_queue_memb3,
+#endif
+};
+
+//The connection using each pool, NULL if the pool is free
+static struct bcp_conn *packet_queue_owners[BCP_MAX_CONNECTIONS];
+
+int bcp_queue_allocator_init(struct bcp_conn *c){
+    struct memb *m = NULL;
+    int8_t slot = -1;
+    uint8_t k;
+
+    //Take the pool of the connection if it is reopened, otherwise a free one
+    for(k = 0; k < BCP_MAX_CONNECTIONS; k++){
+        if(packet_queue_owners[k] == c){
+            slot = k;
+            break;
+        }
+        if(slot < 0 && packet_queue_owners[k] == NULL)
+            slot = k;
+    }
+
+    if(slot >= 0){
+        packet_queue_owners[slot] = c;
+        m = packet_queue_membs[slot];
+        memb_init(m);
+    }
+
+    //The pool is shared by the queues of all the traffic classes
+    for(k = 0; k < BCP_TRAFFIC_CLASSES; k++)
+        c->packet_queue[k].memb = m;
+    return m != NULL;
+}
+
+void bcp_queue_allocator_release(struct bcp_conn *c){
+    uint8_t k;
+
+    for(k = 0; k < BCP_MAX_CONNECTIONS; k++)
+        if(packet_queue_owners[k] == c)
+            packet_queue_owners[k] = NULL;
+    for(k = 0; k < BCP_TRAFFIC_CLASSES; k++)
+        c->packet_queue[k].memb = NULL;
 }
@@ -10,9 +10,16 @@
 
 /**
  * Called after bcp_queue is initialized. This function handles all the complexity details 
- * regarding the memory allocation of the queue list.
+ * regarding the memory allocation of the queue list. Every connection gets its
+ * own memory pool; at most BCP_MAX_CONNECTIONS pools exist.
+ * Returns 1 on success, or 0 if every pool is used by another connection.
  */
-void bcp_queue_allocator_init(struct bcp_conn *c);
+int bcp_queue_allocator_init(struct bcp_conn *c);
+
+/**
+ * Called when the bcp connection is closed to give its memory pool back.
+ */
+void bcp_queue_allocator_release(struct bcp_conn *c);
 
 #endif	/* BCP_QUEUE_ALLOCATOR_H */
 
@@ -22,6 +22,7 @@ void routing_table_init(void *c){
     struct bcp_conn * bcp_c = (struct bcp_conn *) c;
     bcp_c->routing_table.list = &(bcp_c->routing_table_list);
     bcp_c->routing_table.bcp_connection = c;
+    memset(bcp_c->routing_table.next_hop, 0, sizeof(bcp_c->routing_table.next_hop));
     //Init the list
     list_init(bcp_c->routing_table_list);
     
@@ -41,17 +42,68 @@ struct routingtable_item* routing_table_find(struct routingtable *t,
      return i;
 }
 
+/**
+ * \return true if the given neighbor may not be chosen now
+ */
+static bool is_quarantined(struct routingtable_item *i){
+    return i->quarantine_len != 0 
+            && clock_time() - i->quarantine_start < i->quarantine_len;
+}
+
+/**
+ * \return true if the given neighbor has not been heard for 
+ *         BCP_NEIGHBOR_TIMEOUT beacon periods
+ */
+static bool is_stale(struct routingtable *t, struct routingtable_item *i){
+#if BCP_NEIGHBOR_TIMEOUT
+    return clock_time() - i->heard > ((struct bcp_conn *) t->bcp_connection)->config.beacon_time 
+            * BCP_NEIGHBOR_TIMEOUT;
+#else
+    (void) t;
+    (void) i;
+    return false;
+#endif
+}
+
+/**
+ * \return true if the given neighbor may neither be chosen nor lead to a sink
+ */
+static bool is_unusable(struct routingtable *t, struct routingtable_item *i){
+    return is_quarantined(i) || is_stale(t, i);
+}
+
+/**
+ * \breif Moves the backlog estimate of a neighbor towards an advertised backlog.
+ * \return the new estimate
+ */
+static uint16_t smooth_backlog(uint16_t estimate, uint16_t sample){
+    uint16_t s = ((uint32_t) estimate * BCP_BACKLOG_ALPHA 
+            + (uint32_t) sample * (100 - BCP_BACKLOG_ALPHA) + 50) / 100;
+    //Rounding must not stop the estimate short of the sample
+    if(s == estimate && s != sample)
+        s += sample > estimate ? 1 : -1;
+    return s;
+}
+
 int routing_table_update_queuelog(struct routingtable *t,
                                const rimeaddr_t * addr,
-                               uint16_t queuelog){
+                               const uint16_t * queuelog){
     struct routingtable_item *i;
+    uint8_t k;
    
     i = routing_table_find(t, addr);
     
     //No record for this neighbor address
     if(i == NULL) {
+        //Make room by forgetting the neighbors which are gone
+        if(routingtable_length(t) 
+                >= ((struct bcp_conn *) t->bcp_connection)->config.routing_table_size)
+            routingtable_age_out(t);
+        if(routingtable_length(t) 
+                >= ((struct bcp_conn *) t->bcp_connection)->config.routing_table_size)
+            return -1;
         // Allocate memory for the new record
-        i = memb_alloc(t->memb);
+        i = t->memb != NULL ? memb_alloc(t->memb) : NULL;
 
         //Failed to allocate memory
         if(i == NULL) {
@@ -61,7 +113,14 @@ int routing_table_update_queuelog(struct routingtable *t,
         // Set default attributes
         i->next = NULL;
         rimeaddr_copy(&(i->neighbor), addr);
-        i->backpressure = queuelog;
+        memcpy(i->backpressure, queuelog, sizeof(i->backpressure));
+        i->isSink = false;
+        i->provisional = false;
+        i->sink_distance = BCP_DISTANCE_UNKNOWN;
+        i->failures = 0;
+        i->quarantines = 0;
+        i->acked = false;
+        i->quarantine_len = 0;
         
         //Ask weight estimator to initialize its fields 
         weight_estimator_record_init(i);
@@ -69,12 +128,96 @@ int routing_table_update_queuelog(struct routingtable *t,
         //Insert the new record
         list_add(*t->list, i);
     }else{
-        i->backpressure = queuelog;
+        for(k = 0; k < BCP_TRAFFIC_CLASSES; k++)
+            i->backpressure[k] = i->provisional ? queuelog[k] 
+                    : smooth_backlog(i->backpressure[k], queuelog[k]);
+        //The neighbor is alive
+        i->provisional = false;
     }
+    i->heard = clock_time();
     //dbg_print_rtable(t);
     return 1;
 }
 
+int routing_table_update_sink(struct routingtable *t,
+                               const rimeaddr_t * addr,
+                               bool isSink){
+    struct routingtable_item *i;
+    
+    i = routing_table_find(t, addr);
+    if(i == NULL)
+        return 0;
+    
+    i->isSink = isSink;
+    return 1;
+}
+
+int routing_table_update_distance(struct routingtable *t,
+                               const rimeaddr_t * addr,
+                               uint8_t distance){
+    struct routingtable_item *i;
+    
+    i = routing_table_find(t, addr);
+    if(i == NULL)
+        return 0;
+    
+    i->sink_distance = distance;
+    return 1;
+}
+
+uint8_t routingtable_sink_distance(struct routingtable *t){
+    struct routingtable_item *i;
+    uint8_t closest = BCP_DISTANCE_UNKNOWN;
+    
+    //Only the neighbors which may be chosen lead to a sink
+    for(i = list_head(*t->list); i != NULL; i = list_item_next(i))
+        if(i->sink_distance < closest && !is_unusable(t, i))
+            closest = i->sink_distance;
+    
+    if(closest >= BCP_MAX_SINK_DISTANCE)
+        return BCP_DISTANCE_UNKNOWN;
+    return closest + 1;
+}
+
+uint8_t routingtable_link_failed(struct routingtable *t, const rimeaddr_t *addr){
+    struct routingtable_item *i;
+    uint8_t shift;
+    
+    i = routing_table_find(t, addr);
+    if(i == NULL || ++i->failures < BCP_QUARANTINE_FAILURES)
+        return BCP_LINK_OK;
+    
+    //Heard, but never hearing us: keep it out as long as possible
+    if(!i->acked && i->quarantines >= BCP_ASYMMETRIC_QUARANTINES)
+        shift = BCP_QUARANTINE_MAX_SHIFT;
+    else
+        shift = i->quarantines < BCP_QUARANTINE_MAX_SHIFT ? 
+            i->quarantines : BCP_QUARANTINE_MAX_SHIFT;
+    
+    i->failures = 0;
+    i->quarantine_start = clock_time();
+    i->quarantine_len = BCP_QUARANTINE_TIME << shift;
+    if(i->quarantines < 0xFF)
+        i->quarantines++;
+    PRINTF("DEBUG: Neighbor [%d].[%d] quarantined, relapse=%d\n",
+            addr->u8[0], addr->u8[1], i->quarantines);
+    
+    return !i->acked && i->quarantines > BCP_ASYMMETRIC_QUARANTINES ? 
+        BCP_LINK_ASYMMETRIC : BCP_LINK_QUARANTINED;
+}
+
+void routingtable_link_succeeded(struct routingtable *t, const rimeaddr_t *addr){
+    struct routingtable_item *i;
+    
+    i = routing_table_find(t, addr);
+    if(i == NULL)
+        return;
+    i->failures = 0;
+    i->quarantines = 0;
+    i->quarantine_len = 0;
+    i->acked = true;
+}
+
 int routingtable_length(struct routingtable *t)
 {
   return list_length(*t->list);
@@ -85,7 +228,8 @@ int routingtable_length(struct routingtable *t)
 void routingtable_clear(struct routingtable *t){
     
    struct routingtable_item *i;
-   for(i = list_head(*t->list); i != NULL; i = list_item_next(i)) {
+   //list_remove() unlinks the item, so always take the head
+   while((i = list_head(*t->list)) != NULL) {
        list_remove(*t->list, i);
        memb_free(t->memb, i);
    }
@@ -93,19 +237,61 @@ void routingtable_clear(struct routingtable *t){
    PRINTF("DEBUG: Routing table has been cleared\n");
 }
 
+void routingtable_remove_provisional(struct routingtable *t){
+   struct routingtable_item *i;
+   struct routingtable_item *next;
+   
+   for(i = list_head(*t->list); i != NULL; i = next) {
+       next = list_item_next(i);
+       if(i->provisional){
+           PRINTF("DEBUG: Neighbor [%d].[%d] did not confirm; removing it\n",
+                   i->neighbor.u8[0], i->neighbor.u8[1]);
+           list_remove(*t->list, i);
+           memb_free(t->memb, i);
+       }
+   }
+}
 
-rimeaddr_t* routingtable_find_routing( struct routingtable *t){
+void routingtable_age_out(struct routingtable *t){
+   struct routingtable_item *i;
+   struct routingtable_item *next;
+   
+   for(i = list_head(*t->list); i != NULL; i = next) {
+       next = list_item_next(i);
+       if(is_stale(t, i)){
+           PRINTF("DEBUG: Neighbor [%d].[%d] has not been heard; removing it\n",
+                   i->neighbor.u8[0], i->neighbor.u8[1]);
+           list_remove(*t->list, i);
+           memb_free(t->memb, i);
+       }
+   }
+}
+
+
+rimeaddr_t* routingtable_find_routing( struct routingtable *t, uint8_t tclass){
    
    int largestWeight = -32768;
    int neighborWeight;
+   int currentWeight = 0;
    struct routingtable_item * largestNeightbor = NULL;
+   struct routingtable_item * current = NULL;
    struct routingtable_item *i;
    //For each neighbor stored 
    for(i = list_head(*t->list); i != NULL; i = list_item_next(i)) {
+       if(is_unusable(t, i))
+           continue;
        //If smallest weight variable is not yet set 
-       neighborWeight = weight_estimator_getWeight(t->bcp_connection, i);
-       //Has this neighbor smaller weight
-       if(largestWeight <= neighborWeight){
+       neighborWeight = weight_estimator_getWeight(t->bcp_connection, i, tclass);
+       if(rimeaddr_cmp(&i->neighbor, &t->next_hop[tclass])){
+           current = i;
+           currentWeight = neighborWeight;
+       }
+       //Has this neighbor smaller weight. Among equals, a sink is preferred, then
+       //the neighbor closest to a sink
+       if(largestWeight < neighborWeight || (largestWeight == neighborWeight 
+               && (largestNeightbor == NULL || (i->isSink && !largestNeightbor->isSink)
+                   || (i->isSink == largestNeightbor->isSink 
+                       && i->sink_distance < largestNeightbor->sink_distance)))){
            largestWeight = neighborWeight;
            largestNeightbor = i;
        }
@@ -114,6 +300,10 @@ rimeaddr_t* routingtable_find_routing( struct routingtable *t){
    if(largestNeightbor == NULL)
        return NULL;
    
+   //Stay with the current next hop unless the best neighbor is clearly better
+   if(current != NULL && largestWeight - currentWeight < BCP_SWITCH_THRESHOLD
+           && (current->isSink || !largestNeightbor->isSink))
+       largestNeightbor = current;
    
      PRINTF("DEBUG: Best neighbor to send the data packet is node[%d].[%d] \n",
                largestNeightbor->neighbor.u8[0],
@@ -122,20 +312,28 @@ rimeaddr_t* routingtable_find_routing( struct routingtable *t){
    return (&largestNeightbor->neighbor);
 }
 
+void routingtable_route_used(struct routingtable *t, uint8_t tclass,
+                             const rimeaddr_t *addr){
+   rimeaddr_copy(&t->next_hop[tclass], addr);
+}
+
 /*---------------------------------------------------------------------------*/
  void print_routingtable(struct routingtable *t)
 {
   struct routingtable_item *i;
   uint8_t numItems = 0;
   uint8_t count = 1;
+  uint8_t k;
   numItems = routingtable_length(t);
 
   PRINTF("Routing Table Contents: %d entries found\n", numItems);
   PRINTF("------------------------------------------------------------\n");
   for(i = list_head(*t->list); i != NULL; i = list_item_next(i)) {
     PRINTF("Routing table item: %d\n", count);
-    PRINTF("neighbor: %d.%d\n", i->neighbor.u8[0], i->neighbor.u8[1]);
-    PRINTF("backpressure: %d\n", i->backpressure);
+    PRINTF("neighbor: %d.%d%s\n", i->neighbor.u8[0], i->neighbor.u8[1], 
+            i->isSink ? " (sink)" : "");
+    for(k = 0; k < BCP_TRAFFIC_CLASSES; k++)
+      PRINTF("backpressure[%d]: %d\n", k, i->backpressure[k]);
     weight_estimator_print_item(t->bcp_connection, i);
     PRINTF("------------------------------------------------------------\n");
     count++;
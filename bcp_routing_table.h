@@ -12,6 +12,15 @@
 #include "lib/list.h"
 #include "lib/memb.h"
 #include "net/rime.h"
+#include "bcp-config.h"
+
+//The distance of a node which does not know any path to a sink
+#define BCP_DISTANCE_UNKNOWN    0xFF
+
+//Results of routingtable_link_failed()
+#define BCP_LINK_OK             0
+#define BCP_LINK_QUARANTINED    1
+#define BCP_LINK_ASYMMETRIC     2
 
 /**
  * \brief      A structure defines routing table
@@ -28,6 +37,8 @@ struct routingtable {
   struct memb *memb;
   //The parent BCP connection
   void* bcp_connection;
+  //The neighbor the last data packet of every traffic class was sent to
+  rimeaddr_t next_hop[BCP_TRAFFIC_CLASSES];
 };
 
 /**
@@ -41,8 +52,27 @@ struct routingtable_item {
   struct routingtable_item *next;
   //Neighbor rime address
   rimeaddr_t neighbor;
-  //Queue log; updated frequently by the BCP routing
-  uint16_t backpressure;
+  //Queue log of every traffic class; updated frequently by the BCP routing.
+  //Smoothed over the advertised backlogs (see BCP_BACKLOG_ALPHA)
+  uint16_t backpressure[BCP_TRAFFIC_CLASSES];
+  //Whether the neighbor is a sink or not
+  bool isSink;
+  //Number of hops between the neighbor and its closest sink, as advertised
+  uint8_t sink_distance;
+  //Restored from a checkpoint and not heard since
+  bool provisional;
+  //ACK timeouts since the last ACK of this neighbor
+  uint8_t failures;
+  //Quarantines since the last ACK of this neighbor; the next one lasts 
+  //BCP_QUARANTINE_TIME << quarantines
+  uint8_t quarantines;
+  //The neighbor acknowledged at least one of our data packets
+  bool acked;
+  //The neighbor is not chosen until quarantine_len has passed since quarantine_start
+  clock_time_t quarantine_start;
+  clock_time_t quarantine_len;
+  //Last time the neighbor advertised its backlogs (see BCP_NEIGHBOR_TIMEOUT)
+  clock_time_t heard;
   
 };
 
@@ -59,12 +89,25 @@ void routing_table_init(void *c);
  * 
  * \param t the routing table containing neighbor records
  * \param addr the rime address of the neighbor 
- * \param queuelog the new queue log 
- * \return Non-zero if the neighbor record was updated. Otherwise, zero
+ * \param queuelog the new queue logs; one per traffic class
+ * \return 1 if the neighbor record was updated or added. -1 if a new neighbor
+ *        does not fit; the table is full even after removing the neighbors 
+ *        which have not been heard for BCP_NEIGHBOR_TIMEOUT beacon periods
  */
 int routing_table_update_queuelog(struct routingtable *t,
                                const rimeaddr_t * addr,
-                               uint16_t queuelog);
+                               const uint16_t * queuelog);
+/**
+ * \breif Updates whether the given neighbor is a sink or not
+ * 
+ * \param t the routing table containing neighbor records
+ * \param addr the rime address of the neighbor 
+ * \param isSink true if the neighbor advertised itself as a sink
+ * \return Non-zero if the neighbor record was updated. Otherwise, zero
+ */
+int routing_table_update_sink(struct routingtable *t,
+                               const rimeaddr_t * addr,
+                               bool isSink);
 /**
  * \breif finds the given neighbor in the routing table
  * 
@@ -81,6 +124,21 @@ struct routingtable_item* routing_table_find(struct routingtable *t,
  */
 void routingtable_clear(struct routingtable *t);
 
+/**
+ * \breif Removes the provisional records which have not been confirmed.
+ * 
+ * \param t the routing table
+ */
+void routingtable_remove_provisional(struct routingtable *t);
+
+/**
+ * \breif Removes the neighbors which have not been heard for 
+ *        BCP_NEIGHBOR_TIMEOUT beacon periods.
+ * 
+ * \param t the routing table
+ */
+void routingtable_age_out(struct routingtable *t);
+
 /**
  * 
  * \param t the routing table 
@@ -89,12 +147,66 @@ void routingtable_clear(struct routingtable *t);
  */
 int routingtable_length(struct routingtable *t);
 
+/**
+ * \breif Updates the distance to the sinks advertised by a neighbor.
+ * 
+ * \param t the routing table
+ * \param addr the neighbor
+ * \param distance the advertised distance
+ * \return 0 if the neighbor is not in the table. Otherwise, 1.
+ */
+int routing_table_update_distance(struct routingtable *t,
+                               const rimeaddr_t * addr,
+                               uint8_t distance);
+
+/**
+ * \breif Calculates the distance of this node to its closest sink.
+ * 
+ * \param t the routing table
+ * \return one hop more than the closest neighbor, or BCP_DISTANCE_UNKNOWN
+ */
+uint8_t routingtable_sink_distance(struct routingtable *t);
+
+/**
+ * \breif Accounts an ACK timeout of the given neighbor and quarantines it 
+ *        after BCP_QUARANTINE_FAILURES consecutive ones.
+ * 
+ * \param t the routing table
+ * \param addr the neighbor which did not acknowledge
+ * \return BCP_LINK_QUARANTINED or BCP_LINK_ASYMMETRIC if the neighbor has 
+ *         just been quarantined. Otherwise, BCP_LINK_OK
+ */
+uint8_t routingtable_link_failed(struct routingtable *t, const rimeaddr_t *addr);
+
+/**
+ * \breif Clears the failures and quarantines of a neighbor which acknowledged a packet.
+ * 
+ * \param t the routing table
+ * \param addr the neighbor
+ */
+void routingtable_link_succeeded(struct routingtable *t, const rimeaddr_t *addr);
+
 /**
  * 
  * \param t
- * \return Finds the neighbor which has the highest weight in the routing table
+ * \param tclass the traffic class of the packet to route
+ * \return Finds the neighbor which has the highest weight for the given traffic
+ *  class in the routing table. Sinks win ties. The neighbor selected last is 
+ *  kept unless another one is better by BCP_SWITCH_THRESHOLD (see 
+ *  \ref routingtable_route_used()). Quarantined neighbors are skipped. The 
+ *  table is not changed.
+ */
+rimeaddr_t* routingtable_find_routing(struct routingtable *t, uint8_t tclass);
+
+/**
+ * \breif Records the neighbor a data packet of the given class has been sent to.
+ * 
+ * \param t the routing table
+ * \param tclass the traffic class of the packet
+ * \param addr the neighbor; the next lookups stick to it
  */
-rimeaddr_t* routingtable_find_routing(struct routingtable *t);
+void routingtable_route_used(struct routingtable *t, uint8_t tclass,
+                             const rimeaddr_t *addr);
 
 
 #endif /* __ROUTINGTABLE_H__ */
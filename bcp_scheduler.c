@@ -0,0 +1,146 @@
+/**
+ * \file
+ *         The default implementation of the event scheduler (see \ref bcp_scheduler.h).
+ *
+ *         There are few events, so the table is scanned instead of being 
+ *         kept sorted.
+ */
+#include "bcp_scheduler.h"
+
+#include <string.h>
+
+#define DEBUG 0
+#if DEBUG
+#include <stdio.h>
+#define PRINTF(...) printf(__VA_ARGS__)
+#else
+#define PRINTF(...)
+#endif
+
+static void dispatch(void *ptr);
+
+/*********************************UTILITIES************************************/
+/**
+ * \return the time until the event is due; 0 if it is due
+ */
+static clock_time_t remaining(const struct bcp_event *e, clock_time_t now){
+    clock_time_t elapsed = now - e->start;
+    return elapsed >= e->interval ? 0 : e->interval - elapsed;
+}
+
+/**
+ * \return the time until the event must run, including its slack
+ */
+static clock_time_t latest(uint8_t event, const struct bcp_event *e, clock_time_t now){
+    clock_time_t r = remaining(e, now);
+    return event >= BCP_EVENT_FIRST_LAZY ? r + BCP_EVENT_SLACK : r;
+}
+
+/**
+ * \breif Sets the timer to the nearest deadline, or stops it.
+ */
+static void schedule(struct bcp_scheduler *s){
+    clock_time_t now = clock_time();
+    clock_time_t next = 0;
+    bool found = false;
+    clock_time_t t;
+    uint8_t k;
+
+    if(s->dispatching)
+        return;
+    for(k = 0; k < BCP_EVENTS; k++){
+        if(!s->events[k].armed)
+            continue;
+        t = latest(k, &s->events[k], now);
+        if(!found || t < next){
+            next = t;
+            found = true;
+        }
+    }
+    if(found)
+        ctimer_set(&s->timer, next, dispatch, s);
+    else
+        ctimer_stop(&s->timer);
+}
+
+/**
+ * \breif Called by the timer; runs the due events in the order of their ids.
+ * 
+ *      An event runs once per wakeup at most. The callbacks may arm and stop 
+ *      events; the ones which become due are taken in this wakeup if they 
+ *      have not run yet, in the next one otherwise.
+ */
+static void dispatch(void *ptr){
+    struct bcp_scheduler *s = ptr;
+    struct bcp_event *e;
+    uint16_t ran = 0;
+    clock_time_t now, due;
+    uint8_t k;
+
+    s->wakeups++;
+    s->dispatching = true;
+    for(k = 0; k < BCP_EVENTS; ){
+        e = &s->events[k];
+        now = clock_time();
+        due = remaining(e, now);
+        if(!e->armed || (ran & (1 << k)) 
+                || (k < BCP_EVENT_FIRST_LAZY ? due > 0 : due > BCP_EVENT_SLACK)){
+            k++;
+            continue;
+        }
+        PRINTF("DEBUG: Running event %d\n", k);
+        e->armed = false;
+        ran |= 1 << k;
+        e->callback(s->ptr);
+        //A callback may have armed an event which goes before this one
+        k = 0;
+    }
+    s->dispatching = false;
+    schedule(s);
+}
+
+
+/*********************************PUBLIC FUNCTIONS*****************************/
+void scheduler_init(struct bcp_scheduler *s, void *ptr){
+    memset(s, 0, sizeof(struct bcp_scheduler));
+    s->ptr = ptr;
+}
+
+void scheduler_set(struct bcp_scheduler *s, uint8_t event, clock_time_t interval,
+                   void (*callback)(void *)){
+    struct bcp_event *e = &s->events[event];
+
+    e->start = clock_time();
+    e->interval = interval;
+    e->callback = callback;
+    e->armed = true;
+    schedule(s);
+}
+
+void scheduler_reset(struct bcp_scheduler *s, uint8_t event){
+    struct bcp_event *e = &s->events[event];
+
+    //There is no interval nor callback to reuse yet
+    if(e->callback == NULL)
+        return;
+    e->start += e->interval;
+    e->armed = true;
+    schedule(s);
+}
+
+void scheduler_stop(struct bcp_scheduler *s, uint8_t event){
+    s->events[event].armed = false;
+    schedule(s);
+}
+
+bool scheduler_expired(struct bcp_scheduler *s, uint8_t event){
+    return !s->events[event].armed;
+}
+
+void scheduler_stop_all(struct bcp_scheduler *s){
+    uint8_t k;
+
+    for(k = 0; k < BCP_EVENTS; k++)
+        s->events[k].armed = false;
+    ctimer_stop(&s->timer);
+}
@@ -0,0 +1,100 @@
+/**
+ * \file
+ *         Header file for the event scheduler of a bcp connection.
+ *
+ *         All the timed events of a connection share one ctimer, which is set
+ *         to the nearest deadline. When events are due together, they run in 
+ *         the order of their ids: the ACK timeout decides the next hop before 
+ *         data is sent, and data goes before beacons, since data frames carry
+ *         the backlogs too. Housekeeping events (from BCP_EVENT_BEACON on) may
+ *         run up to BCP_EVENT_SLACK early or late, so they share a wakeup 
+ *         with another event whenever one is close.
+ */
+#ifndef __BCP_SCHEDULER_H__
+#define __BCP_SCHEDULER_H__
+
+#include <stdbool.h>
+#include "net/rime.h"
+#include "sys/ctimer.h"
+#include "bcp-config.h"
+
+//The events of a bcp connection, in the order they run when due together
+#define BCP_EVENT_ACK_TIMEOUT   0   // The ACK of the data frame did not arrive
+#define BCP_EVENT_TX_STALL      1   // The radio did not report a frame as sent
+#define BCP_EVENT_ANYCAST       2   // The back-off of an overheard packet ended
+#define BCP_EVENT_SEND          3   // Send the next data packet
+#define BCP_EVENT_BEACON        4   // Send a beacon
+#define BCP_EVENT_TELEMETRY     5   // Send the telemetry reports
+#define BCP_EVENT_PROVISIONAL   6   // Remove the unconfirmed restored neighbors
+#define BCP_EVENT_CHECKPOINT    7   // Save the routing table
+#define BCP_EVENT_SINK_DUMP     8   // Print the statistics of the sink
+#define BCP_EVENTS              9
+
+//The first event which may be moved by BCP_EVENT_SLACK
+#define BCP_EVENT_FIRST_LAZY    BCP_EVENT_BEACON
+
+/**
+ * \brief      A timed event of a bcp connection
+ */
+struct bcp_event {
+  //The event is due interval ticks after start
+  clock_time_t start;
+  clock_time_t interval;
+  void (*callback)(void *);
+  bool armed;
+};
+
+/**
+ * \brief      The events of a bcp connection and their common timer
+ */
+struct bcp_scheduler {
+  struct bcp_event events[BCP_EVENTS];
+  struct ctimer timer;
+  //Passed to the callbacks
+  void *ptr;
+  //Events are running; the timer is set once they are done
+  bool dispatching;
+  //Number of times the timer fired
+  uint32_t wakeups;
+};
+
+/**
+ * \breif Initializes the scheduler; no event is armed.
+ * \param s the scheduler
+ * \param ptr the argument of the callbacks, usually the bcp connection
+ */
+void scheduler_init(struct bcp_scheduler *s, void *ptr);
+
+/**
+ * \breif Arms an event. An armed event is moved to the new deadline.
+ * \param s the scheduler
+ * \param event BCP_EVENT_*
+ * \param interval the time from now after which the event is due
+ * \param callback the function to call when the event is due
+ */
+void scheduler_set(struct bcp_scheduler *s, uint8_t event, clock_time_t interval,
+                   void (*callback)(void *));
+
+/**
+ * \breif Arms an event again with the same interval, counted from its 
+ *        previous deadline (see ctimer_reset()). Does nothing if the event
+ *        has never been set.
+ */
+void scheduler_reset(struct bcp_scheduler *s, uint8_t event);
+
+/**
+ * \breif Disarms an event.
+ */
+void scheduler_stop(struct bcp_scheduler *s, uint8_t event);
+
+/**
+ * \return true if the event is not armed: it ran, was stopped or was never set
+ */
+bool scheduler_expired(struct bcp_scheduler *s, uint8_t event);
+
+/**
+ * \breif Disarms all the events and stops the timer.
+ */
+void scheduler_stop_all(struct bcp_scheduler *s);
+
+#endif /* __BCP_SCHEDULER_H__ */
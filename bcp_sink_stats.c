@@ -0,0 +1,156 @@
+/**
+ * \file
+ *         The default implementation of the sink delivery analytics (see \ref bcp_sink_stats.h).
+ *
+ *         Sequence numbers are tracked with a sliding window below the highest
+ *         one received. A gap is counted as lost when a higher sequence number
+ *         arrives and is taken back if the missing packet arrives late.
+ *         Packets older than the window cannot be told from duplicates, so 
+ *         they are counted apart. A packet far older than the window means 
+ *         that the origin restarted (see BCP_SEQNO_RESTART_GAP).
+ */
+#include "bcp_sink_stats.h"
+
+#include <stdio.h>
+#include <string.h>
+
+
+/*********************************UTILITIES************************************/
+/**
+ * \return the record of the given origin, a free record for it, or NULL if
+ *         the table is full
+ */
+static struct bcp_origin_stats *find_or_add(struct bcp_sink_stats *s, 
+                                            const rimeaddr_t *origin){
+    struct bcp_origin_stats *slot = NULL;
+    uint8_t k;
+
+    for(k = 0; k < BCP_SINK_MAX_ORIGINS; k++){
+        if(!s->origins[k].used){
+            if(slot == NULL)
+                slot = &s->origins[k];
+        }else if(rimeaddr_cmp(&s->origins[k].origin, origin)){
+            return &s->origins[k];
+        }
+    }
+    if(slot != NULL){
+        memset(slot, 0, sizeof(struct bcp_origin_stats));
+        rimeaddr_copy(&slot->origin, origin);
+    }
+    return slot;
+}
+
+//Outcomes of track_seqno()
+#define SEQNO_NEW               0
+#define SEQNO_DUPLICATE         1
+#define SEQNO_OUT_OF_WINDOW     2
+
+/**
+ * \breif Accounts the sequence number of a received packet.
+ * \return SEQNO_NEW, or SEQNO_DUPLICATE or SEQNO_OUT_OF_WINDOW if the packet
+ *         is not counted as received
+ */
+static uint8_t track_seqno(struct bcp_origin_stats *o, uint16_t seqno){
+    int16_t distance = (int16_t)(seqno - o->last_seqno);
+    uint16_t behind;
+
+    if(o->used && distance < -BCP_SEQNO_RESTART_GAP){
+        //The origin numbers its packets from 0 again; the counters are kept
+        o->restarts++;
+        o->used = false;
+    }
+
+    if(!o->used){
+        o->used = true;
+        o->last_seqno = seqno;
+        o->window = 1;
+        return SEQNO_NEW;
+    }
+
+    if(distance > 0){
+        //Newer packet; the skipped ones are missing for now
+        o->lost += distance - 1;
+        o->window = distance < SINK_STATS_WINDOW ? o->window << distance : 0;
+        o->window |= 1;
+        o->last_seqno = seqno;
+        return SEQNO_NEW;
+    }
+
+    behind = -distance;
+    if(behind >= SINK_STATS_WINDOW)
+        return SEQNO_OUT_OF_WINDOW;
+    if(o->window & ((uint32_t) 1 << behind))
+        return SEQNO_DUPLICATE;
+
+    //Late packet; it was counted as lost
+    o->window |= (uint32_t) 1 << behind;
+    if(o->lost > 0)
+        o->lost--;
+    o->reordered++;
+    if(behind > o->max_reorder)
+        o->max_reorder = behind;
+    return SEQNO_NEW;
+}
+
+
+/*********************************PUBLIC FUNCTIONS*****************************/
+void sink_stats_init(struct bcp_sink_stats *s){
+    memset(s, 0, sizeof(struct bcp_sink_stats));
+}
+
+void sink_stats_update(struct bcp_sink_stats *s, const struct bcp_packet_header *hdr){
+    struct bcp_origin_stats *o = find_or_add(s, &hdr->origin);
+    clock_time_t t = hdr->delay;
+    uint8_t bucket = 0;
+
+    if(o == NULL){
+        s->untracked++;
+        return;
+    }
+
+    switch(track_seqno(o, hdr->seqno)){
+    case SEQNO_DUPLICATE:
+        o->duplicates++;
+        return;
+    case SEQNO_OUT_OF_WINDOW:
+        o->out_of_window++;
+        return;
+    }
+    o->received++;
+
+    while(t > 0 && bucket < BCP_LATENCY_BUCKETS - 1){
+        t >>= 1;
+        bucket++;
+    }
+    if(o->latency[bucket] < 0xFFFF)
+        o->latency[bucket]++;
+}
+
+struct bcp_origin_stats *sink_stats_find(struct bcp_sink_stats *s, const rimeaddr_t *origin){
+    uint8_t k;
+    for(k = 0; k < BCP_SINK_MAX_ORIGINS; k++)
+        if(s->origins[k].used && rimeaddr_cmp(&s->origins[k].origin, origin))
+            return &s->origins[k];
+    return NULL;
+}
+
+void sink_stats_print(struct bcp_sink_stats *s){
+    struct bcp_origin_stats *o;
+    uint8_t k, b;
+
+    for(k = 0; k < BCP_SINK_MAX_ORIGINS; k++){
+        o = &s->origins[k];
+        if(!o->used)
+            continue;
+        printf("SINK origin=%d.%d rx=%lu lost=%lu dup=%lu reord=%lu maxreord=%u oow=%lu restarts=%u lat=",
+               o->origin.u8[0], o->origin.u8[1],
+               (unsigned long) o->received, (unsigned long) o->lost,
+               (unsigned long) o->duplicates, (unsigned long) o->reordered,
+               o->max_reorder, (unsigned long) o->out_of_window, o->restarts);
+        for(b = 0; b < BCP_LATENCY_BUCKETS; b++)
+            printf(b == 0 ? "%u" : ",%u", o->latency[b]);
+        printf("\n");
+    }
+    if(s->untracked > 0)
+        printf("SINK untracked=%lu\n", (unsigned long) s->untracked);
+}
@@ -0,0 +1,84 @@
+/**
+ * \file
+ *         Header file for the end-to-end delivery analytics of a sink.
+ *
+ *         A sink keeps the state of every origin whose packets it collects:
+ *         the sequence numbers it received, to count lost, duplicated and 
+ *         reordered packets, and a histogram of the end-to-end delays.
+ */
+#ifndef __BCP_SINK_STATS_H__
+#define __BCP_SINK_STATS_H__
+
+#include <stdbool.h>
+#include "net/rime.h"
+#include "bcp-config.h"
+#include "bcp_queue.h"
+
+//Number of sequence numbers below the highest one which are remembered
+#define SINK_STATS_WINDOW   32
+
+/**
+ * \brief      The delivery statistics of an origin
+ */
+struct bcp_origin_stats {
+  //The node which generated the packets
+  rimeaddr_t origin;
+  //Whether the record is in use
+  bool used;
+  //Highest sequence number received
+  uint16_t last_seqno;
+  //Bit k is set if the sequence number last_seqno - k has been received
+  uint32_t window;
+  //Distinct packets received
+  uint32_t received;
+  //Sequence numbers skipped and not received (yet)
+  uint32_t lost;
+  //Packets received more than once
+  uint32_t duplicates;
+  //Packets received after a packet with a higher sequence number
+  uint32_t reordered;
+  //Largest distance between a reordered packet and the highest sequence number
+  uint16_t max_reorder;
+  //Packets older than SINK_STATS_WINDOW; whether they were lost or are 
+  //duplicates is not known, so they are not counted as received
+  uint32_t out_of_window;
+  //Times the origin numbered its packets from 0 again (see BCP_SEQNO_RESTART_GAP)
+  uint16_t restarts;
+  //Histogram of the end-to-end delays. Bucket k counts the delays shorter 
+  //than 2^k clock ticks; the last one counts the longer ones too
+  uint16_t latency[BCP_LATENCY_BUCKETS];
+};
+
+/**
+ * \brief      The delivery statistics of a sink
+ */
+struct bcp_sink_stats {
+  struct bcp_origin_stats origins[BCP_SINK_MAX_ORIGINS];
+  //Packets of origins which did not fit into the table
+  uint32_t untracked;
+};
+
+/**
+ * \breif Clears the statistics.
+ */
+void sink_stats_init(struct bcp_sink_stats *s);
+
+/**
+ * \breif Accounts a packet delivered at the sink.
+ * \param s the statistics of the sink
+ * \param hdr the header of the packet
+ */
+void sink_stats_update(struct bcp_sink_stats *s, const struct bcp_packet_header *hdr);
+
+/**
+ * \return the statistics of the given origin, or NULL if none of its packets
+ *         has been accounted
+ */
+struct bcp_origin_stats *sink_stats_find(struct bcp_sink_stats *s, const rimeaddr_t *origin);
+
+/**
+ * \breif Prints one line per origin.
+ */
+void sink_stats_print(struct bcp_sink_stats *s);
+
+#endif /* __BCP_SINK_STATS_H__ */
@@ -0,0 +1,66 @@
+/**
+ * \file
+ *         The default implementation of the telemetry report table (see \ref bcp_telemetry.h).
+ */
+#include "bcp_telemetry.h"
+
+#include <stdio.h>
+#include <string.h>
+
+
+/*********************************PUBLIC FUNCTIONS*****************************/
+void telemetry_init(struct telemetry_table *t){
+    memset(t, 0, sizeof(struct telemetry_table));
+}
+
+void telemetry_merge(struct telemetry_table *t, const struct bcp_telemetry *report){
+    struct telemetry_entry *e;
+    struct telemetry_entry *slot = NULL;
+    clock_time_t now = clock_time();
+    uint8_t k;
+
+    for(k = 0; k < BCP_TELEMETRY_MAX_REPORTS; k++){
+        e = &t->entries[k];
+        if(e->used && rimeaddr_cmp(&e->report.node, &report->node)){
+            slot = e;
+            break;
+        }
+        //Prefer a free entry, otherwise the oldest report
+        if(slot == NULL || (slot->used && (!e->used 
+                || (clock_time_t)(now - e->time) > (clock_time_t)(now - slot->time))))
+            slot = e;
+    }
+
+    memcpy(&slot->report, report, sizeof(struct bcp_telemetry));
+    slot->time = now;
+    slot->used = true;
+}
+
+uint8_t telemetry_take(struct telemetry_table *t, struct bcp_telemetry *reports, uint8_t max){
+    uint8_t n = 0;
+    uint8_t k;
+
+    for(k = 0; k < BCP_TELEMETRY_MAX_REPORTS && n < max; k++){
+        if(!t->entries[k].used)
+            continue;
+        memcpy(&reports[n++], &t->entries[k].report, sizeof(struct bcp_telemetry));
+        t->entries[k].used = false;
+    }
+    return n;
+}
+
+void telemetry_print(struct telemetry_table *t){
+    struct telemetry_entry *e;
+    uint8_t k;
+
+    for(k = 0; k < BCP_TELEMETRY_MAX_REPORTS; k++){
+        e = &t->entries[k];
+        if(!e->used)
+            continue;
+        printf("TELEMETRY node=%d.%d age=%lu qpeak=%u retx=%u drops=%u neighbors=%u churn=%u\n",
+               e->report.node.u8[0], e->report.node.u8[1],
+               (unsigned long)((clock_time() - e->time) / CLOCK_SECOND),
+               e->report.queue_peak, e->report.retransmissions, e->report.drops,
+               e->report.neighbors, e->report.churn);
+    }
+}
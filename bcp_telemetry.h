@@ -0,0 +1,84 @@
+/**
+ * \file
+ *         Header file for the in-band network telemetry of BCP.
+ *
+ *         Every node periodically builds a compact report of its congestion
+ *         state and sends it towards the sinks in a telemetry frame. Relays 
+ *         keep the reports they receive and merge them into their own next 
+ *         frame, so a report costs one frame per hop and period at most. 
+ *         Sinks keep the latest report of every node: a map of the congestion 
+ *         of the network.
+ */
+#ifndef __BCP_TELEMETRY_H__
+#define __BCP_TELEMETRY_H__
+
+#include <stdbool.h>
+#include "net/rime.h"
+#include "bcp-config.h"
+
+/**
+ * \brief      The congestion report of a node
+ */
+struct bcp_telemetry {
+  //The node which made the report
+  rimeaddr_t node;
+  //Largest length of its packet queues since its previous report
+  uint16_t queue_peak;
+  //Retransmissions since its previous report
+  uint16_t retransmissions;
+  //Packets refused by its full queues since its previous report
+  uint16_t drops;
+  //Number of neighbors in its routing table
+  uint8_t neighbors;
+  //Number of times its best neighbor changed since its previous report
+  uint8_t churn;
+};
+
+/**
+ * \brief      A report kept by a node
+ */
+struct telemetry_entry {
+  struct bcp_telemetry report;
+  //When the report was received
+  clock_time_t time;
+  bool used;
+};
+
+/**
+ * \brief      The telemetry state of a bcp connection
+ * 
+ *             On relays, the table holds the reports waiting to be forwarded.
+ *             On sinks, it holds the latest report of every node.
+ */
+struct telemetry_table {
+  struct telemetry_entry entries[BCP_TELEMETRY_MAX_REPORTS];
+};
+
+/**
+ * \breif Forgets all the reports of the table.
+ */
+void telemetry_init(struct telemetry_table *t);
+
+/**
+ * \breif Stores a report in the table.
+ * 
+ *      A report replaces the previous one of the same node. When the table is
+ *      full, the oldest report is replaced.
+ */
+void telemetry_merge(struct telemetry_table *t, const struct bcp_telemetry *report);
+
+/**
+ * \breif Removes reports from the table.
+ * \param t the table
+ * \param reports the array to fill
+ * \param max the size of the array
+ * \return the number of reports removed
+ */
+uint8_t telemetry_take(struct telemetry_table *t, struct bcp_telemetry *reports, uint8_t max);
+
+/**
+ * \breif Prints one line per report.
+ */
+void telemetry_print(struct telemetry_table *t);
+
+#endif /* __BCP_TELEMETRY_H__ */
@@ -0,0 +1,142 @@
+/**
+ * \file
+ *         The default implementation of the BCP event trace (see \ref bcp_trace.h).
+ *
+ *         The ring is written by the bcp connections and read by the drain 
+ *         process, which both run in the Contiki process context.
+ */
+#include "bcp_trace.h"
+
+#include <stdio.h>  //For printf
+#include <string.h>
+
+#if (BCP_TRACE_SIZE == 0) || (BCP_TRACE_SIZE & (BCP_TRACE_SIZE - 1))
+#error "BCP_TRACE_SIZE must be a power of two"
+#endif
+
+
+#if BCP_TRACE_MASK
+/*********************************DECLARATIONS*********************************/
+static struct bcp_trace_record ring[BCP_TRACE_SIZE];
+//Free running read and write indexes of the ring
+static uint16_t ring_head;
+static uint16_t ring_tail;
+//Records dropped because the ring was full
+static uint16_t lost;
+
+#if BCP_TRACE_DRAIN_TIME
+PROCESS(bcp_trace_process, "BCP trace drain");
+
+
+/*********************************UTILITIES************************************/
+/**
+ * \breif Writes a record to the serial line as one text line.
+ */
+static void drain_record(const struct bcp_trace_record *r){
+    uint8_t b[BCP_TRACE_RECORD_SIZE];
+    uint8_t k;
+
+    b[0] = r->time;
+    b[1] = r->time >> 8;
+    b[2] = r->time >> 16;
+    b[3] = r->time >> 24;
+    b[4] = r->event;
+    b[5] = r->tclass;
+    b[6] = r->neighbor.u8[0];
+    b[7] = r->neighbor.u8[1];
+    b[8] = r->backlog;
+    b[9] = r->backlog >> 8;
+    b[10] = r->qlen;
+    b[11] = r->qlen >> 8;
+
+    printf(BCP_TRACE_PREFIX);
+    for(k = 0; k < BCP_TRACE_RECORD_SIZE; k++)
+        printf("%02x", b[k]);
+    printf("\n");
+}
+
+
+/*********************************PROCESS**************************************/
+PROCESS_THREAD(bcp_trace_process, ev, data)
+{
+  static struct etimer et;
+  static struct bcp_trace_record r;
+
+  PROCESS_BEGIN();
+  (void) ev;
+  (void) data;
+
+  etimer_set(&et, BCP_TRACE_DRAIN_TIME);
+  while(1) {
+    PROCESS_WAIT_EVENT_UNTIL(etimer_expired(&et));
+    etimer_reset(&et);
+
+    if(lost > 0){
+        memset(&r, 0, sizeof(struct bcp_trace_record));
+        r.time = clock_time();
+        r.event = BCP_TRACE_LOST;
+        r.backlog = lost;
+        lost = 0;
+        drain_record(&r);
+    }
+    while(bcp_trace_read(&r, 1) > 0)
+        drain_record(&r);
+  }
+
+  PROCESS_END();
+}
+#endif /* BCP_TRACE_DRAIN_TIME */
+
+
+/*********************************PUBLIC FUNCTIONS*****************************/
+void bcp_trace_init(void){
+#if BCP_TRACE_DRAIN_TIME
+    if(!process_is_running(&bcp_trace_process))
+        process_start(&bcp_trace_process, NULL);
+#endif
+}
+
+void bcp_trace_write(uint8_t event, uint8_t tclass, const rimeaddr_t *neighbor,
+                     uint16_t backlog, uint16_t qlen){
+    struct bcp_trace_record *r;
+
+    if((uint16_t)(ring_tail - ring_head) >= BCP_TRACE_SIZE){
+        lost++;
+        return;
+    }
+
+    r = &ring[ring_tail & (BCP_TRACE_SIZE - 1)];
+    r->time = clock_time();
+    r->event = event;
+    r->tclass = tclass;
+    rimeaddr_copy(&r->neighbor, neighbor != NULL ? neighbor : &rimeaddr_null);
+    r->backlog = backlog;
+    r->qlen = qlen;
+    ring_tail++;
+}
+
+uint16_t bcp_trace_read(struct bcp_trace_record *records, uint16_t max){
+    uint16_t n = 0;
+
+    while(n < max && ring_head != ring_tail){
+        memcpy(&records[n++], &ring[ring_head & (BCP_TRACE_SIZE - 1)],
+                sizeof(struct bcp_trace_record));
+        ring_head++;
+    }
+    return n;
+}
+
+#else /* BCP_TRACE_MASK */
+
+void bcp_trace_init(void){
+}
+
+void bcp_trace_write(uint8_t event, uint8_t tclass, const rimeaddr_t *neighbor,
+                     uint16_t backlog, uint16_t qlen){
+}
+
+uint16_t bcp_trace_read(struct bcp_trace_record *records, uint16_t max){
+    return 0;
+}
+
+#endif /* BCP_TRACE_MASK */
@@ -0,0 +1,99 @@
+/**
+ * \file
+ *         Header file for the BCP event trace.
+ *
+ *         Trace points write fixed-size binary records into a RAM ring. The
+ *         ring is drained asynchronously to the serial line, which the 
+ *         printouts of the application share. Every record is therefore 
+ *         written as a line of its own: BCP_TRACE_PREFIX followed by the 
+ *         BCP_TRACE_RECORD_SIZE bytes below in hexadecimal, little-endian:
+ *
+ *         offset 0  uint32_t  clock_time() of the event
+ *         offset 4  uint8_t   event (BCP_TRACE_*)
+ *         offset 5  uint8_t   traffic class
+ *         offset 6  uint8_t[2] neighbor address (0.0 when there is none)
+ *         offset 8  uint16_t  backlog of the class
+ *         offset 10 uint16_t  length of the packet queue of the class
+ *
+ *         bcp_trace_decode.c is a host tool which turns these lines into
+ *         readable ones and passes the other lines through.
+ *
+ *         Trace points are selected at compile time with BCP_TRACE_MASK; a 
+ *         disabled trace point costs nothing.
+ */
+#ifndef __BCP_TRACE_H__
+#define __BCP_TRACE_H__
+
+#include "contiki.h"
+#include "net/rime.h"
+#include "bcp-config.h"
+
+//Trace events. Control frames are traced with the class BCP_CLASS_HIGHEST
+#define BCP_TRACE_DATA_SENT                 0
+#define BCP_TRACE_DATA_RECEIVED             1
+#define BCP_TRACE_ACK_SENT                  2
+#define BCP_TRACE_ACK_RECEIVED              3
+#define BCP_TRACE_ACK_TIMEOUT               4
+#define BCP_TRACE_BEACON_SENT               5
+#define BCP_TRACE_BEACON_RECEIVED           6
+#define BCP_TRACE_BEACON_REQUEST_SENT       7
+#define BCP_TRACE_BEACON_REQUEST_RECEIVED   8
+#define BCP_TRACE_QUEUE_DROP                9
+#define BCP_TRACE_DUPLICATE                 10
+#define BCP_TRACE_SINK_DELIVERED            11
+#define BCP_TRACE_OVERHEARD                 12
+#define BCP_TRACE_NO_NEIGHBOR               13
+//The neighbor field holds the quarantined neighbor
+#define BCP_TRACE_QUARANTINE                14
+//Written by the drain when records were lost; the backlog field holds their number
+#define BCP_TRACE_LOST                      15
+
+//Starts every record line on the serial line
+#define BCP_TRACE_PREFIX        "#BCPT "
+//Number of bytes of a record line
+#define BCP_TRACE_RECORD_SIZE   12
+
+/**
+ * \brief      A record of the trace ring
+ */
+struct bcp_trace_record {
+  uint32_t time;
+  uint8_t event;
+  uint8_t tclass;
+  rimeaddr_t neighbor;
+  uint16_t backlog;
+  uint16_t qlen;
+};
+
+/**
+ * \breif Writes a trace record if the event is enabled in BCP_TRACE_MASK.
+ * 
+ *      The arguments are not evaluated for disabled events.
+ */
+#define BCP_TRACE(event, tclass, neighbor, backlog, qlen) do { \
+    if(BCP_TRACE_MASK & (1UL << (event))) \
+        bcp_trace_write((event), (tclass), (neighbor), (backlog), (qlen)); \
+  } while(0)
+
+/**
+ * \breif Starts draining the trace ring. Calling it again has no effect.
+ */
+void bcp_trace_init(void);
+
+/**
+ * \breif Appends a record to the trace ring. Use BCP_TRACE() instead.
+ * 
+ *      When the ring is full, the record is dropped and counted as lost.
+ */
+void bcp_trace_write(uint8_t event, uint8_t tclass, const rimeaddr_t *neighbor,
+                     uint16_t backlog, uint16_t qlen);
+
+/**
+ * \breif Removes the oldest records from the trace ring.
+ * \param records the array to fill
+ * \param max the size of the array
+ * \return the number of records copied
+ */
+uint16_t bcp_trace_read(struct bcp_trace_record *records, uint16_t max);
+
+#endif /* __BCP_TRACE_H__ */
@@ -0,0 +1,101 @@
+/**
+ * \file
+ *         Host tool which decodes the BCP event trace (see \ref bcp_trace.h).
+ *
+ *         Reads the serial output of a node, or of a native process, and
+ *         prints every trace line as readable text. The other lines are
+ *         passed through unchanged, unless -t is given.
+ *
+ *         Build and use it on the host:
+ *         cc -o bcp_trace_decode bcp_trace_decode.c
+ *         ./bcp_trace_decode [-t] < serial.log
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+//Keep in line with bcp_trace.h
+#define BCP_TRACE_PREFIX        "#BCPT "
+#define BCP_TRACE_RECORD_SIZE   12
+
+static const char *event_names[] = {
+  "DATA_SENT",
+  "DATA_RECEIVED",
+  "ACK_SENT",
+  "ACK_RECEIVED",
+  "ACK_TIMEOUT",
+  "BEACON_SENT",
+  "BEACON_RECEIVED",
+  "BEACON_REQUEST_SENT",
+  "BEACON_REQUEST_RECEIVED",
+  "QUEUE_DROP",
+  "DUPLICATE",
+  "SINK_DELIVERED",
+  "OVERHEARD",
+  "NO_NEIGHBOR",
+  "QUARANTINE",
+  "LOST",
+};
+
+
+/*********************************UTILITIES************************************/
+/**
+ * \breif Converts the hexadecimal bytes of a record line.
+ * \return 0 if the line holds a whole record. Otherwise, -1
+ */
+static int parse_record(const char *hex, uint8_t *b){
+    unsigned int v;
+    int k;
+
+    for(k = 0; k < BCP_TRACE_RECORD_SIZE; k++){
+        if(sscanf(hex + 2 * k, "%2x", &v) != 1)
+            return -1;
+        b[k] = v;
+    }
+    return 0;
+}
+
+/**
+ * \breif Prints a decoded record.
+ */
+static void print_record(const uint8_t *b){
+    uint32_t time = b[0] | (uint32_t) b[1] << 8 | (uint32_t) b[2] << 16
+            | (uint32_t) b[3] << 24;
+    uint16_t backlog = b[8] | b[9] << 8;
+    uint16_t qlen = b[10] | b[11] << 8;
+
+    if(b[4] == 15){
+        printf("TRACE time=%lu LOST records=%u\n", (unsigned long) time, backlog);
+        return;
+    }
+    if(b[4] < sizeof(event_names) / sizeof(event_names[0])){
+        printf("TRACE time=%lu %s", (unsigned long) time, event_names[b[4]]);
+    }else{
+        printf("TRACE time=%lu EVENT_%u", (unsigned long) time, b[4]);
+    }
+    printf(" class=%u neighbor=%u.%u backlog=%u qlen=%u\n", b[5], b[6], b[7],
+           backlog, qlen);
+}
+
+
+/*********************************MAIN*****************************************/
+int main(int argc, char **argv){
+    char line[512];
+    uint8_t b[BCP_TRACE_RECORD_SIZE];
+    size_t prefix = strlen(BCP_TRACE_PREFIX);
+    int traceOnly = argc > 1 && strcmp(argv[1], "-t") == 0;
+    char *start;
+
+    while(fgets(line, sizeof(line), stdin) != NULL){
+        //Lines of other printouts may precede the record on the same line
+        start = strstr(line, BCP_TRACE_PREFIX);
+        if(start != NULL && parse_record(start + prefix, b) == 0){
+            if(!traceOnly && start != line)
+                printf("%.*s\n", (int)(start - line), line);
+            print_record(b);
+        }else if(!traceOnly){
+            fputs(line, stdout);
+        }
+    }
+    return 0;
+}
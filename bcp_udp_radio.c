@@ -0,0 +1,358 @@
+/**
+ * \file
+ *         The UDP multicast radio for the native platform (see \ref bcp_udp_radio.h).
+ *
+ *         Every frame is sent to a multicast group on the loopback interface,
+ *         so all the nodes running on the host hear it, like they would on a
+ *         shared radio channel. The socket is watched by an epoll instance
+ *         which is hooked into the select() loop of the native platform.
+ *         When it becomes readable, the radio process drains the socket with
+ *         recvmmsg() and feeds the frames one by one to the RDC layer.
+ *         Outgoing frames are collected during an event and flushed with a
+ *         single sendmmsg() call.
+ *
+ *         The radio keeps its state in file-scope variables, so a process
+ *         runs one node. This is the model of the native platform, whose
+ *         node address and network stack are global as well.
+ */
+#define _GNU_SOURCE  //For recvmmsg and sendmmsg
+#include "bcp_udp_radio.h"
+#include "bcp_link_trace.h"
+
+#include "contiki.h"
+#include "net/packetbuf.h"
+#include "net/netstack.h"
+
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+#define DEBUG 0
+#if DEBUG
+#include <stdio.h>
+#define PRINTF(...) printf(__VA_ARGS__)
+#else
+#define PRINTF(...)
+#endif
+
+
+/*********************************DECLARATIONS*********************************/
+/**
+ * \brief      The header prepended to every frame sent to the multicast group.
+ */
+struct udp_frame_hdr {
+  /**
+   * Identifies the frames of this radio
+   */
+  uint8_t magic;
+  /**
+   * The node which sent the frame. Used to drop our own looped back frames.
+   */
+  rimeaddr_t sender;
+  /**
+   * Numbers the frames of the sender. Identifies the frame in link records.
+   */
+  uint16_t seqno;
+};
+
+#define UDP_FRAME_MAGIC         0xBC
+//A received frame is copied to the data area of the packetbuf
+#define UDP_FRAME_MAX_PAYLOAD   PACKETBUF_SIZE
+#define UDP_FRAME_SIZE          (sizeof(struct udp_frame_hdr) + UDP_FRAME_MAX_PAYLOAD)
+
+static int sock = -1;
+static int epfd = -1;
+static struct sockaddr_in group_addr;
+
+//Receive batch
+static uint8_t rx_buf[BCP_UDP_RADIO_BATCH][UDP_FRAME_SIZE];
+static struct iovec rx_iov[BCP_UDP_RADIO_BATCH];
+static struct mmsghdr rx_msgs[BCP_UDP_RADIO_BATCH];
+
+//Transmit batch
+static uint8_t tx_buf[BCP_UDP_RADIO_BATCH][UDP_FRAME_SIZE];
+static struct iovec tx_iov[BCP_UDP_RADIO_BATCH];
+static struct mmsghdr tx_msgs[BCP_UDP_RADIO_BATCH];
+static int tx_count;
+static uint16_t tx_seqno;
+
+//The frame loaded by prepare() and sent by transmit()
+static uint8_t pending_frame[UDP_FRAME_MAX_PAYLOAD];
+static unsigned short pending_len;
+
+PROCESS(bcp_udp_radio_process, "UDP multicast radio");
+
+
+/*********************************UTILITIES************************************/
+/**
+ * \breif Sends all the frames of the transmit batch with one system call.
+ *
+ *      Frames which the socket cannot take are dropped, like frames lost in
+ *      a collision.
+ */
+static void flush_tx(void){
+    int sent = 0;
+    int n;
+
+    while(sent < tx_count){
+        n = sendmmsg(sock, &tx_msgs[sent], tx_count - sent, 0);
+        if(n <= 0){
+            if(n < 0 && errno == EINTR)
+                continue;
+            PRINTF("ERROR: UDP radio dropped %d frames\n", tx_count - sent);
+            break;
+        }
+        sent += n;
+    }
+    tx_count = 0;
+}
+
+/**
+ * \breif Adds a frame to the transmit batch.
+ * \param payload the frame
+ * \param len the length of the frame
+ * \return RADIO_TX_OK, or RADIO_TX_ERR if the frame is too long
+ */
+static int queue_frame(const void *payload, unsigned short len){
+    struct udp_frame_hdr *hdr;
+
+    if(len > UDP_FRAME_MAX_PAYLOAD)
+        return RADIO_TX_ERR;
+
+    if(tx_count == BCP_UDP_RADIO_BATCH)
+        flush_tx();
+
+    hdr = (struct udp_frame_hdr *) tx_buf[tx_count];
+    hdr->magic = UDP_FRAME_MAGIC;
+    rimeaddr_copy(&hdr->sender, &rimeaddr_node_addr);
+    hdr->seqno = tx_seqno++;
+    memcpy(hdr + 1, payload, len);
+    link_trace_sent(hdr->seqno, len);
+    tx_iov[tx_count].iov_len = sizeof(struct udp_frame_hdr) + len;
+    tx_count++;
+
+    //The batch is flushed once the current event has been handled
+    process_poll(&bcp_udp_radio_process);
+    return RADIO_TX_OK;
+}
+
+/**
+ * \breif Receives all the waiting frames and passes them to the RDC layer.
+ */
+static void read_frames(void){
+    struct udp_frame_hdr *hdr;
+    unsigned int len;
+    int16_t rssi;
+    int n;
+    int i;
+
+    do{
+        n = recvmmsg(sock, rx_msgs, BCP_UDP_RADIO_BATCH, MSG_DONTWAIT, NULL);
+        if(n <= 0)
+            return;
+
+        for(i = 0; i < n; i++){
+            hdr = (struct udp_frame_hdr *) rx_buf[i];
+            len = rx_msgs[i].msg_len;
+            if(len < sizeof(struct udp_frame_hdr) || hdr->magic != UDP_FRAME_MAGIC)
+                continue;
+            //Longer than the packetbuf, e.g. sent by a node built differently
+            if(rx_msgs[i].msg_hdr.msg_flags & MSG_TRUNC)
+                continue;
+            //Multicast loops our own frames back
+            if(rimeaddr_cmp(&hdr->sender, &rimeaddr_node_addr))
+                continue;
+
+            len -= sizeof(struct udp_frame_hdr);
+            if(len > UDP_FRAME_MAX_PAYLOAD)
+                continue;
+            //The link model decides whether we hear the frame at all
+            if(!link_trace_accept(&hdr->sender, hdr->seqno, len, &rssi))
+                continue;
+            packetbuf_clear();
+            memcpy(packetbuf_dataptr(), hdr + 1, len);
+            packetbuf_set_datalen(len);
+            packetbuf_set_attr(PACKETBUF_ATTR_RSSI, rssi);
+            NETSTACK_RDC.input();
+        }
+    }while(n == BCP_UDP_RADIO_BATCH);
+}
+
+/**
+ * Hooks the epoll instance into the select() loop of the native platform.
+ */
+static int set_fd(fd_set *rset, fd_set *wset){
+    (void) wset;
+    FD_SET(epfd, rset);
+    return 1;
+}
+
+static void handle_fd(fd_set *rset, fd_set *wset){
+    struct epoll_event events[1];
+
+    (void) wset;
+    if(FD_ISSET(epfd, rset) && epoll_wait(epfd, events, 1, 0) > 0)
+        process_poll(&bcp_udp_radio_process);
+}
+
+static const struct select_callback udp_radio_select_callback = { set_fd, handle_fd };
+
+
+/*********************************PROCESS**************************************/
+PROCESS_THREAD(bcp_udp_radio_process, ev, data)
+{
+  PROCESS_BEGIN();
+  (void) data;
+
+  while(1) {
+    PROCESS_YIELD_UNTIL(ev == PROCESS_EVENT_POLL);
+    flush_tx();
+    read_frames();
+  }
+
+  PROCESS_END();
+}
+
+
+/*********************************RADIO DRIVER*********************************/
+static int udp_radio_init(void){
+    struct ip_mreq mreq;
+    struct sockaddr_in local;
+    struct epoll_event event;
+    int on = 1;
+    int ttl = 1;
+    int rcvbuf = 1 << 20;
+    int i;
+
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if(sock < 0){
+        PRINTF("ERROR: UDP radio cannot open a socket\n");
+        return 0;
+    }
+
+    //Every node of the host binds the same port
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+#ifdef SO_REUSEPORT
+    setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+#endif
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_port = htons(BCP_UDP_RADIO_PORT);
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    if(bind(sock, (struct sockaddr *) &local, sizeof(local)) < 0){
+        PRINTF("ERROR: UDP radio cannot bind port %d\n", BCP_UDP_RADIO_PORT);
+        close(sock);
+        sock = -1;
+        return 0;
+    }
+
+    //Join the group on the loopback interface and keep the traffic there
+    memset(&group_addr, 0, sizeof(group_addr));
+    group_addr.sin_family = AF_INET;
+    group_addr.sin_port = htons(BCP_UDP_RADIO_PORT);
+    group_addr.sin_addr.s_addr = inet_addr(BCP_UDP_RADIO_GROUP);
+    mreq.imr_multiaddr = group_addr.sin_addr;
+    mreq.imr_interface.s_addr = htonl(INADDR_LOOPBACK);
+    setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq));
+    setsockopt(sock, IPPROTO_IP, IP_MULTICAST_IF, &mreq.imr_interface,
+            sizeof(mreq.imr_interface));
+    setsockopt(sock, IPPROTO_IP, IP_MULTICAST_LOOP, &on, sizeof(on));
+    setsockopt(sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+
+    //Prepare the batches
+    for(i = 0; i < BCP_UDP_RADIO_BATCH; i++){
+        rx_iov[i].iov_base = rx_buf[i];
+        rx_iov[i].iov_len = UDP_FRAME_SIZE;
+        memset(&rx_msgs[i], 0, sizeof(struct mmsghdr));
+        rx_msgs[i].msg_hdr.msg_iov = &rx_iov[i];
+        rx_msgs[i].msg_hdr.msg_iovlen = 1;
+
+        tx_iov[i].iov_base = tx_buf[i];
+        memset(&tx_msgs[i], 0, sizeof(struct mmsghdr));
+        tx_msgs[i].msg_hdr.msg_iov = &tx_iov[i];
+        tx_msgs[i].msg_hdr.msg_iovlen = 1;
+        tx_msgs[i].msg_hdr.msg_name = &group_addr;
+        tx_msgs[i].msg_hdr.msg_namelen = sizeof(group_addr);
+    }
+    tx_count = 0;
+    tx_seqno = 0;
+    link_trace_init();
+
+    epfd = epoll_create1(0);
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = sock;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, sock, &event);
+    select_set_callback(epfd, &udp_radio_select_callback);
+
+    process_start(&bcp_udp_radio_process, NULL);
+    PRINTF("DEBUG: UDP radio joined %s:%d\n", BCP_UDP_RADIO_GROUP, BCP_UDP_RADIO_PORT);
+    return 1;
+}
+
+static int udp_radio_prepare(const void *payload, unsigned short payload_len){
+    if(payload_len > UDP_FRAME_MAX_PAYLOAD)
+        return 1;
+    memcpy(pending_frame, payload, payload_len);
+    pending_len = payload_len;
+    return 0;
+}
+
+static int udp_radio_transmit(unsigned short transmit_len){
+    //The frame prepared last is sent as it is
+    (void) transmit_len;
+    return queue_frame(pending_frame, pending_len);
+}
+
+static int udp_radio_send(const void *payload, unsigned short payload_len){
+    return queue_frame(payload, payload_len);
+}
+
+static int udp_radio_read(void *buf, unsigned short buf_len){
+    //Frames are pushed to the RDC layer by the radio process
+    (void) buf;
+    (void) buf_len;
+    return 0;
+}
+
+static int udp_radio_channel_clear(void){
+    return 1;
+}
+
+static int udp_radio_receiving_packet(void){
+    return 0;
+}
+
+static int udp_radio_pending_packet(void){
+    return 0;
+}
+
+static int udp_radio_on(void){
+    return 1;
+}
+
+static int udp_radio_off(void){
+    return 1;
+}
+
+const struct radio_driver bcp_udp_radio_driver = {
+    udp_radio_init,
+    udp_radio_prepare,
+    udp_radio_transmit,
+    udp_radio_send,
+    udp_radio_read,
+    udp_radio_channel_clear,
+    udp_radio_receiving_packet,
+    udp_radio_pending_packet,
+    udp_radio_on,
+    udp_radio_off,
+};
@@ -0,0 +1,37 @@
+/**
+ * \file
+ *         Header file for the UDP multicast radio.
+ *
+ *         A radio driver for the native (Linux) platform. It lets the BCP
+ *         logic run unmodified as a Linux process: every process is one node
+ *         and a loopback UDP multicast group stands in for the radio channel.
+ *         Frames are received with recvmmsg() from an epoll event loop and
+ *         sent in batches with sendmmsg(). Which frames a node hears can be
+ *         driven by a link trace (see \ref bcp_link_trace.h).
+ *
+ *         Select it in project-conf.h with
+ *         #define NETSTACK_CONF_RADIO bcp_udp_radio_driver
+ */
+#ifndef __BCP_UDP_RADIO_H__
+#define __BCP_UDP_RADIO_H__
+
+#include "dev/radio.h"
+
+//Multicast group used as the radio channel
+#ifndef BCP_UDP_RADIO_GROUP
+#define BCP_UDP_RADIO_GROUP "239.255.20.14"
+#endif
+
+//UDP port of the radio channel
+#ifndef BCP_UDP_RADIO_PORT
+#define BCP_UDP_RADIO_PORT 20146
+#endif
+
+//Maximum number of frames moved by one recvmmsg()/sendmmsg() call
+#ifndef BCP_UDP_RADIO_BATCH
+#define BCP_UDP_RADIO_BATCH 32
+#endif
+
+extern const struct radio_driver bcp_udp_radio_driver;
+
+#endif /* __BCP_UDP_RADIO_H__ */
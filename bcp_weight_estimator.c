@@ -3,7 +3,14 @@
  *         Default implementation for the weight estimator
  *         
  *         In this implementation the weight is calculated based on the orginal
- *         backpressure weight equation (delta queuelogs).
+ *         backpressure weight equation (delta queuelogs) minus V times the
+ *         expected number of transmissions (ETX) of the link.
+ *         
+ *         Every node tunes its own V (see BCP_V_TUNING). After every
+ *         BCP_V_TUNE_PACKETS acknowledged packets, V is lowered when the queues
+ *         fill up over good links, raised when the links are lossy and the
+ *         queues have room, and otherwise moved in the direction which last
+ *         increased the delivery rate.
  *          
  * 
  */
@@ -27,55 +34,292 @@
  */
 struct routingtable_item_bcp {
   struct routingtable_item item;
+  //Expected number of transmissions of the link, in hundredths 
+  //(see link_loss_alpha in \ref "struct bcp_config")
+  uint16_t etx;
 };
 
+//ETX of a perfect link
+#define ETX_ONE     100
+
+/**
+ * \brief      The state of the V controller of one bcp connection
+ */
+struct v_tuner {
+  //Current V, in tenths
+  uint16_t v;
+  //Last step applied to V: -1, 0 or 1
+  int8_t direction;
+  //Packets acknowledged and transmissions spent in the current window
+  uint16_t delivered;
+  uint16_t attempts;
+  //Start of the current window and duration of the previous one
+  clock_time_t window_start;
+  clock_time_t last_window;
+};
 
 
+
+#if BCP_MAX_CONNECTIONS > 4
+#error "At most 4 bcp connections are supported (BCP_MAX_CONNECTIONS)"
+#endif
+
 //Memory allocation for the routing table. This is defined here because 
 //weight estimators may require to add extra columns to the routingtable_item 
-MEMB(routing_table_memb, struct routingtable_item_bcp, MAX_ROUTING_TABLE_SIZE);
+MEMB(routing_table_memb0, struct routingtable_item_bcp, MAX_ROUTING_TABLE_SIZE);
+#if BCP_MAX_CONNECTIONS > 1
+MEMB(routing_table_memb1, struct routingtable_item_bcp, MAX_ROUTING_TABLE_SIZE);
+#endif
+#if BCP_MAX_CONNECTIONS > 2
+MEMB(routing_table_memb2, struct routingtable_item_bcp, MAX_ROUTING_TABLE_SIZE);
+#endif
+#if BCP_MAX_CONNECTIONS > 3
+MEMB(routing_table_memb3, struct routingtable_item_bcp, MAX_ROUTING_TABLE_SIZE);
+#endif
+
+static struct memb * const routing_table_membs[BCP_MAX_CONNECTIONS] = {
+  &routing_table_memb0,
+#if BCP_MAX_CONNECTIONS > 1
+  &routing_table_memb1,
+#endif
+#if BCP_MAX_CONNECTIONS > 2
+  &routing_table_memb2,
+#endif
+#if BCP_MAX_CONNECTIONS > 3
+  &routing_table_memb3,
+#endif
+};
+
+/**
+ * \brief      The state of one bcp connection; the pool k uses routing_table_membs[k]
+ */
+struct routing_table_pool {
+  //The connection using this pool, NULL if the pool is free
+  struct bcp_conn *owner;
+  struct v_tuner tuner;
+};
+
+static struct routing_table_pool routing_table_pools[BCP_MAX_CONNECTIONS];
+
+
+/*********************************UTILITIES************************************/
+/**
+ * \return the pool of the given connection, or NULL
+ */
+static struct routing_table_pool *find_pool(struct bcp_conn *c){
+    uint8_t k;
+    for(k = 0; k < BCP_MAX_CONNECTIONS; k++)
+        if(routing_table_pools[k].owner == c)
+            return &routing_table_pools[k];
+    return NULL;
+}
+
+/**
+ * \return the occupancy of the fullest packet queue, in percent
+ */
+static uint8_t queue_occupancy(struct bcp_conn *c){
+    uint16_t occupancy = 0;
+    uint16_t o;
+    uint8_t k;
+    for(k = 0; k < BCP_TRAFFIC_CLASSES; k++){
+        o = bcp_queue_length(&c->packet_queue[k]) * 100 / c->config.queue_size;
+        if(o > occupancy)
+            occupancy = o;
+    }
+    return occupancy;
+}
+
+/**
+ * \breif Adjusts V at the end of a window of BCP_V_TUNE_PACKETS packets.
+ */
+static void tune_v(struct bcp_conn *c, struct v_tuner *t){
+    clock_time_t now = clock_time();
+    clock_time_t window = now - t->window_start;
+    uint8_t retx = (t->attempts - t->delivered) * 100 / t->attempts;
+    uint8_t occupancy = queue_occupancy(c);
+    int step;
+    int v;
+    
+    if(occupancy > BCP_V_QUEUE_TARGET && retx <= BCP_V_RETX_TARGET){
+        //The queues build up over good links; follow the backlogs
+        step = -1;
+    }else if(retx > BCP_V_RETX_TARGET && occupancy <= BCP_V_QUEUE_TARGET){
+        //Lossy links and room in the queues; avoid the costly links
+        step = 1;
+    }else if(occupancy > 0 && t->direction != 0){
+        //Backlogged: keep the direction which delivered the window faster
+        step = window <= t->last_window ? t->direction : -t->direction;
+    }else{
+        step = 0;
+    }
+    
+    v = (int) t->v + step * BCP_V_STEP;
+    if(v < BCP_V_MIN)
+        v = BCP_V_MIN;
+    if(v > BCP_V_MAX)
+        v = BCP_V_MAX;
+    PRINTF("DEBUG: V tuning: retx=%d%%, occupancy=%d%%, V=%d -> %d\n",
+            retx, occupancy, t->v, v);
+    t->v = v;
+    t->direction = step;
+    t->last_window = window;
+    t->window_start = now;
+    t->delivered = 0;
+    t->attempts = 0;
+}
 
 
 
 /*********************************BCP PUBLIC FUNCTION**************************/
-int weight_estimator_getWeight(struct bcp_conn *c, struct routingtable_item * it){
+int weight_estimator_getWeight(struct bcp_conn *c, struct routingtable_item * it,
+                                uint8_t tclass){
     struct routingtable_item_bcp * i = (struct routingtable_item_bcp *) it;
     int w = 0;
     
     
-    //Calculate the weight 
-    w = (int) bcp_queue_length(&c->packet_queue);
-    w -= i->item.backpressure;
+    //Calculate the weight (per-class backlog differential)
+    w = (int) bcp_queue_backlog(&c->packet_queue[tclass]);
+    w -= i->item.backpressure[tclass];
+    
+    //Cost of the link; V is in tenths and ETX in hundredths
+    w -= (long) weight_estimator_v(c) * i->etx / (10 * ETX_ONE);
+    
+    //Penalize the neighbors far from the sinks. Without a backlog gradient 
+    //(light load), packets follow the shortest path
+    if(i->item.sink_distance == BCP_DISTANCE_UNKNOWN)
+        w -= BCP_HOP_PENALTY * (BCP_MAX_SINK_DISTANCE + 1);
+    else
+        w -= BCP_HOP_PENALTY * i->item.sink_distance;
   
     return (int)w; 
 }
 
-void weight_estimator_sent(struct routingtable_item * it, 
+void weight_estimator_sent(struct bcp_conn *c, struct routingtable_item * it, 
                                 struct bcp_queue_item *qi, 
                                 uint16_t attempts){
-    uint16_t new_link_packet_tx_time;
     struct routingtable_item_bcp * i = (struct routingtable_item_bcp *) it;
+    struct routing_table_pool *p;
     
     PRINTF("DEBUG: Weight estimator updates routingtable_item metrics. Neighbor[%d].[%d], Attempts=[%d]\n"
         , it->neighbor.u8[0]
         , it->neighbor.u8[1]
         , attempts
         );
+    if(attempts == 0)
+        attempts = 1;
+    
+    //Update the ETX of the link
+    i->etx = ((uint32_t) c->config.link_loss_alpha * i->etx 
+            + (uint32_t) (100 - c->config.link_loss_alpha) * attempts * ETX_ONE) / 100;
+    
+#if BCP_V_TUNING
+    p = find_pool(c);
+    if(p == NULL)
+        return;
+    //All the transmissions of the packet, whichever neighbor they went to
+    p->tuner.delivered++;
+    p->tuner.attempts += qi->hdr.attempts > attempts ? qi->hdr.attempts : attempts;
+    if(p->tuner.delivered >= BCP_V_TUNE_PACKETS)
+        tune_v(c, &p->tuner);
+#endif
+}
+
+void weight_estimator_failed(struct bcp_conn *c, struct routingtable_item * it, 
+                                uint16_t attempts){
+    struct routingtable_item_bcp * i = (struct routingtable_item_bcp *) it;
+    
+    //The packet needs one transmission more at least
+    i->etx = ((uint32_t) c->config.link_loss_alpha * i->etx 
+            + (uint32_t) (100 - c->config.link_loss_alpha) * (attempts + 1) * ETX_ONE) / 100;
+}
+
+uint16_t weight_estimator_v(struct bcp_conn *c){
+    struct routing_table_pool *p = find_pool(c);
+    return p != NULL ? p->tuner.v : c->config.link_loss_v * 10;
+}
+
+void weight_estimator_config_changed(struct bcp_conn *c){
+    struct routing_table_pool *p = find_pool(c);
+    
+    if(p == NULL)
+        return;
+    p->tuner.v = c->config.link_loss_v * 10;
+    p->tuner.direction = 0;
+}
+
+int weight_estimator_init(struct bcp_conn *c){
+    struct routing_table_pool *p = NULL;
+    uint8_t k;
+    
+    //Take the pool of the connection if it is reopened, otherwise a free one
+    for(k = 0; k < BCP_MAX_CONNECTIONS; k++){
+        if(routing_table_pools[k].owner == c){
+            p = &routing_table_pools[k];
+            break;
+        }
+        if(p == NULL && routing_table_pools[k].owner == NULL)
+            p = &routing_table_pools[k];
+    }
     
+    if(p == NULL){
+        c->routing_table.memb = NULL;
+        return 0;
+    }
+    
+    p->owner = c;
+    memset(&p->tuner, 0, sizeof(struct v_tuner));
+    p->tuner.v = c->config.link_loss_v * 10;
+    p->tuner.window_start = clock_time();
+    c->routing_table.memb = routing_table_membs[p - routing_table_pools];
+    memb_init(c->routing_table.memb);
+    return 1;
 }
 
-void weight_estimator_init(struct bcp_conn *c){
-    c->routing_table.memb = &routing_table_memb;
-    memb_init(&routing_table_memb);
+void weight_estimator_close(struct bcp_conn *c){
+    uint8_t k;
+    
+    for(k = 0; k < BCP_MAX_CONNECTIONS; k++)
+        if(routing_table_pools[k].owner == c)
+            routing_table_pools[k].owner = NULL;
+    c->routing_table.memb = NULL;
 }
 
 void weight_estimator_record_init(struct routingtable_item * it){
-    struct routingtable_item_bcp * i =  it;
+    struct routingtable_item_bcp * i = (struct routingtable_item_bcp *) it;
     
+    //New links are assumed perfect until data is sent over them
+    i->etx = ETX_ONE;
+}
+
+void weight_estimator_save(struct routingtable_item *it, uint8_t *buf, uint8_t len){
+    struct routingtable_item_bcp * i = (struct routingtable_item_bcp *) it;
+    
+    if(len < 2)
+        return;
+    buf[0] = i->etx & 0xFF;
+    buf[1] = i->etx >> 8;
+}
+
+void weight_estimator_restore(struct routingtable_item *it, const uint8_t *buf, uint8_t len){
+    struct routingtable_item_bcp * i = (struct routingtable_item_bcp *) it;
+    
+    if(len < 2)
+        return;
+    i->etx = buf[0] | (uint16_t) buf[1] << 8;
+    if(i->etx < ETX_ONE)
+        i->etx = ETX_ONE;
 }
 
 void weight_estimator_print_item(struct bcp_conn *c, struct routingtable_item *item){
-    struct routingtable_item_bcp * i = item;
+#if DEBUG
+    struct routingtable_item_bcp * i = (struct routingtable_item_bcp *) item;
+    uint8_t k;
     
-    PRINTF("Weight: %d\n", weight_estimator_getWeight(c, item));
+    PRINTF("ETX: %d.%02d\n", i->etx / ETX_ONE, i->etx % ETX_ONE);
+    for(k = 0; k < BCP_TRAFFIC_CLASSES; k++)
+        PRINTF("Weight[%d]: %d\n", k, weight_estimator_getWeight(c, item, k));
+#else
+    (void) c;
+    (void) item;
+#endif
 }
\ No newline at end of file
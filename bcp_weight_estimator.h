@@ -18,14 +18,26 @@
 #define __WEIGHT_ESTIMATOR_H__
 #include "bcp.h"
 
+//bcp.h may be the file including this one; the connection is not defined yet
+struct bcp_conn;
+
 /**
  * \breif Initializes weight estimator component for the given bcp connection
  * 
  * \param c an opened bcp connection.
+ * \return 1 on success, or 0 if the routing table memory of every one of the
+ *      BCP_MAX_CONNECTIONS connections is used
  * 
  *      This function is called before using any other weight_estimator_* functions.
  */
-void weight_estimator_init(struct bcp_conn *c);
+int weight_estimator_init(struct bcp_conn *c);
+
+/**
+ * \breif Releases the resources of the weight estimator for the given bcp connection
+ * 
+ * \param c the bcp connection which is being closed.
+ */
+void weight_estimator_close(struct bcp_conn *c);
 
 /**
  * \breif Initializes weight estimator metrics for the given routing table record
@@ -39,22 +51,68 @@ void weight_estimator_record_init(struct routingtable_item * it);
 /**
  * \breif Informs the weight estimators that a new packet has been successfully sent. 
  * 
+ * \param c the bcp connection which sent the packet
  * \param it the routing table record for the destination address
  * \param i the packet record in the packet queue of the bcp connection
- * \param attempts the number of required transactions 
+ * \param attempts the number of transmissions of the packet to this neighbor
  */
-void weight_estimator_sent(struct routingtable_item * it, 
+void weight_estimator_sent(struct bcp_conn *c, struct routingtable_item * it, 
                                 struct bcp_queue_item *i, 
                                 uint16_t attempts);
 
+/**
+ * \breif Informs the weight estimators that a neighbor did not acknowledge a packet.
+ * 
+ * \param c the bcp connection which sent the packet
+ * \param it the routing table record for the neighbor
+ * \param attempts the number of transmissions of the packet to this neighbor so far
+ */
+void weight_estimator_failed(struct bcp_conn *c, struct routingtable_item * it, 
+                                uint16_t attempts);
+
 /**
  * \breif Calculates the weight for the given neighbor
  * 
  * \param c The bcp connection for the routing table
  * \param it the routing table record for the neighbor
+ * \param tclass the traffic class for which the weight is calculated
  * \return The weight of the given neighbor 
  */
-int weight_estimator_getWeight(struct bcp_conn *c, struct routingtable_item * it);
+int weight_estimator_getWeight(struct bcp_conn *c, struct routingtable_item * it,
+                                uint8_t tclass);
+
+/**
+ * \return the current V of the given bcp connection, in tenths
+ * 
+ * \param c an opened bcp connection
+ */
+uint16_t weight_estimator_v(struct bcp_conn *c);
+
+/**
+ * \breif Informs the weight estimator that the link settings of the given 
+ *        connection changed (see \ref bcp_set_config())
+ * 
+ * \param c an opened bcp connection
+ */
+void weight_estimator_config_changed(struct bcp_conn *c);
+
+/**
+ * \breif Saves the weight estimator metrics of the given routing record to a checkpoint
+ * 
+ * \param it the routing table record
+ * \param buf the buffer of the checkpoint
+ * \param len the size of the buffer (BCP_CHECKPOINT_STATE_SIZE)
+ */
+void weight_estimator_save(struct routingtable_item *it, uint8_t *buf, uint8_t len);
+
+/**
+ * \breif Restores the weight estimator metrics of the given routing record from a checkpoint
+ * 
+ * \param it the routing table record
+ * \param buf the buffer filled by weight_estimator_save()
+ * \param len the size of the buffer
+ */
+void weight_estimator_restore(struct routingtable_item *it, const uint8_t *buf, uint8_t len);
 
 /**
  * \breif Prints weight estimator metrics for the given routing record
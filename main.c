@@ -51,7 +51,7 @@ static struct bcp_conn bcp;
       //PRINTF("Sending function\n");
        packetbuf_copyfrom("HI", 2);
        //PRINTF("$$$Generating a new packet, data=%s; counter=%d \n", packetbuf_dataptr(), ++counter );
-       bcp_send(&bcp); 
+       bcp_send(&bcp, BCP_CLASS_LOWEST); 
        //Reset the  timer
        ctimer_set(&send_data_timer, time_ee, sn, NULL);
   }
@@ -69,7 +69,7 @@ PROCESS_THREAD(main_process, ev, data)
   PROCESS_BEGIN();
     PRINTF("Hi function\n");
   counter_recv = counter = 0; 
-  bcp_open(&bcp, 146, &bcp_callbacks);
+  bcp_open(&bcp, 146, &bcp_callbacks, NULL);
 
   //Set the sink node
   addr.u8[0] = 1;
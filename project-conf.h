@@ -1,2 +1,7 @@
 #define NETSTACK_CONF_RDC 		nullrdc_driver
 #define NETSTACK_CONF_MAC 		nullmac_driver
+
+//On the native platform every process is a node on a UDP multicast channel
+#ifdef CONTIKI_TARGET_NATIVE
+#define NETSTACK_CONF_RADIO 		bcp_udp_radio_driver
+#endif